@@ -0,0 +1,108 @@
+#pragma once
+
+#include <inttypes.h>
+#include <float.h>
+
+// Prefetch distance search over a dataset that stays resident between
+// evaluations. A coarse pass tries the lower bound and every power of two up
+// to the upper bound, then a golden-section search refines the bracket around
+// the best coarse point, assuming the cost is unimodal inside it. Every
+// distance is evaluated at most once and the cheapest one seen is returned.
+typedef double (*DistanceCostFnT)(void *context, uint64_t distance);
+
+#define MAX_AUTOTUNE_EVALUATIONS 128
+#define AUTOTUNE_INV_PHI 0.6180339887498949
+
+typedef struct
+{
+    DistanceCostFnT fn;
+    void *context;
+    uint64_t distances[MAX_AUTOTUNE_EVALUATIONS];
+    double costs[MAX_AUTOTUNE_EVALUATIONS];
+    uint32_t evaluations;
+    uint64_t bestDistance;
+    double bestCost;
+} AutotuneT;
+
+static inline double autotuneCost(AutotuneT *tune, const uint64_t distance)
+{
+    for (uint32_t i = 0; i < tune->evaluations; i++)
+    {
+        if (tune->distances[i] == distance)
+        {
+            return tune->costs[i];
+        }
+    }
+    const double cost = tune->fn(tune->context, distance);
+    if (tune->evaluations < MAX_AUTOTUNE_EVALUATIONS)
+    {
+        tune->distances[tune->evaluations] = distance;
+        tune->costs[tune->evaluations] = cost;
+        tune->evaluations++;
+    }
+    if (cost < tune->bestCost)
+    {
+        tune->bestCost = cost;
+        tune->bestDistance = distance;
+    }
+    return cost;
+}
+
+static inline AutotuneT autotuneDistance(const uint64_t minDistance, const uint64_t maxDistance, DistanceCostFnT fn,
+                                         void *context)
+{
+    AutotuneT tune = {.fn = fn, .context = context, .evaluations = 0u, .bestDistance = minDistance, .bestCost = DBL_MAX};
+
+    // Coarse pass.
+    uint64_t coarse[66];
+    uint32_t numCoarse = 0u;
+    coarse[numCoarse++] = minDistance;
+    for (uint64_t d = 1ull; d <= maxDistance && d != 0ull; d <<= 1ull)
+    {
+        if (d > minDistance)
+        {
+            coarse[numCoarse++] = d;
+        }
+    }
+    if (coarse[numCoarse - 1u] != maxDistance)
+    {
+        coarse[numCoarse++] = maxDistance;
+    }
+    uint32_t best = 0u;
+    for (uint32_t i = 0; i < numCoarse; i++)
+    {
+        if (autotuneCost(&tune, coarse[i]) < autotuneCost(&tune, coarse[best]))
+        {
+            best = i;
+        }
+    }
+
+    // Golden-section refinement between the coarse neighbours of the best.
+    uint64_t lo = coarse[best == 0u ? 0u : best - 1u];
+    uint64_t hi = coarse[best + 1u == numCoarse ? best : best + 1u];
+    while (hi - lo > 2ull)
+    {
+        const uint64_t span = (uint64_t)((double)(hi - lo) * AUTOTUNE_INV_PHI + 0.5);
+        uint64_t a = hi - span;
+        uint64_t b = lo + span;
+        a = a <= lo ? lo + 1ull : a;
+        b = b <= a ? a + 1ull : (b >= hi ? hi - 1ull : b);
+        if (b <= a)
+        {
+            break;
+        }
+        if (autotuneCost(&tune, a) <= autotuneCost(&tune, b))
+        {
+            hi = b;
+        }
+        else
+        {
+            lo = a;
+        }
+    }
+    for (uint64_t d = lo; d <= hi; d++)
+    {
+        autotuneCost(&tune, d);
+    }
+    return tune;
+}
@@ -5,9 +5,17 @@
 #include <stdarg.h>
 #include "fasttime.h"
 #include "common.h"
+#include "prng.h"
+#include "autotune.h"
+#include "pages.h"
+#include "dataset_cache.h"
+#include "snapshot.h"
+#include "cycle_primes.h"
 #include <assert.h>
 #include <float.h>
 
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
 typedef struct
 {
     uint64_t nextIndex;
@@ -30,19 +38,63 @@ char *traversalConfigToString(TraversalConfigT self)
     return createFormattedString("%" PRIu64 ",%" PRIu64, 8 * self.p, self.totalAccesses);
 }
 
+// What enablePrefetch selects: nothing; the current node's whole inner array
+// (8 * inner.p bytes) before the inner loop; only its first prefetchLines
+// cache lines; or the whole inner array of the node prefetchDistance outer
+// steps ahead.
+typedef enum
+{
+    PREFETCH_NONE,
+    PREFETCH_WHOLE,
+    PREFETCH_LINES,
+    PREFETCH_AHEAD,
+    NUM_PREFETCH_STRATEGIES
+} PrefetchStrategyT;
+
+static const char *const prefetchStrategyNames[NUM_PREFETCH_STRATEGIES] = {"none", "whole", "lines", "ahead"};
+
+// Where the inner arrays live: one malloc each, or carved in outer-index
+// order from a single slab, back to back (packed) or each starting on a cache
+// line or a 4K page. padLines adds that many cache lines after every array in
+// a slab, which staggers the arrays' starting sets when their size is a
+// multiple of the set stride.
+typedef enum
+{
+    LAYOUT_MALLOC,
+    LAYOUT_PACKED,
+    LAYOUT_LINE,
+    LAYOUT_PAGE,
+    NUM_LAYOUTS
+} LayoutT;
+
+static const char *const layoutNames[NUM_LAYOUTS] = {"malloc", "packed", "line", "page"};
+
+#define CACHE_LINE_BYTES 64ull
+
 typedef struct
 {
     TraversalConfigT inner;
     TraversalConfigT outer;
-    int enablePrefetch;
+    PrefetchStrategyT enablePrefetch;
+    uint64_t prefetchLines;
+    uint64_t prefetchDistance;
+    LayoutT layout;
+    uint64_t padLines;
     int trials;
+    TrialPolicyT policy;
+    uint64_t latencyEvery; // Time every Nth inner access in sampled passes, 0 for none
+    uint32_t initThreads;
+    int counters;
+    PageModeT pages;
+    int populate;
+    char *snapshotDir; // Where slab layouts are mapped from or saved to, if set
 } ConfigT;
 
 char *getConfigHeader()
 {
     char *innerHeader = getTraversalConfigHeader("inner");
     char *outerHeader = getTraversalConfigHeader("outer");
-    char *result = createFormattedString("HW10,%s,%s,totalKB,enablePrefetch", innerHeader, outerHeader);
+    char *result = createFormattedString("HW10,%s,%s,totalKB,enablePrefetch,prefetchStrategy,prefetchLines,prefetchDistance,layout,padLines,pages,populate,ciPercent,budgetMs", innerHeader, outerHeader);
     free(innerHeader);
     free(outerHeader);
     return result;
@@ -52,7 +104,11 @@ char *configToString(ConfigT self)
 {
     char *innerString = traversalConfigToString(self.inner);
     char *outerString = traversalConfigToString(self.outer);
-    char *result = createFormattedString("HW10,%s,%s,%d,%d", innerString, outerString, (int)(self.inner.p * self.outer.p) / 128, self.enablePrefetch);
+    char *result = createFormattedString("HW10,%s,%s,%d,%d,%s,%" PRIu64 ",%" PRIu64 ",%s,%" PRIu64 ",%s,%d,%f,%f", innerString, outerString,
+                                          (int)(self.inner.p * self.outer.p) / 128, self.enablePrefetch,
+                                          prefetchStrategyNames[self.enablePrefetch], self.prefetchLines, self.prefetchDistance,
+                                          layoutNames[self.layout], self.padLines, pageModeNames[self.pages], self.populate,
+                                          self.policy.ciPercent, self.policy.budgetMs);
     free(innerString);
     free(outerString);
     return result;
@@ -64,57 +120,152 @@ static inline uint64_t getNext(const uint64_t index, const uint64_t P)
     return next >= P ? next - P : next;
 }
 
+typedef struct
+{
+    ConfigT config;
+    OuterNodeT *data;
+} CycleFillT;
+
+// Every entry on the cycle holds getNext of its own index, so the outer nodes
+// can be filled independently of the walk order.
+static void fillCycleRange(void *context, uint64_t begin, uint64_t end)
+{
+    const CycleFillT *fill = context;
+    for (uint64_t i = begin; i < end; i++)
+    {
+        fill->data[i].nextIndex = getNext(i, fill->config.outer.p);
+        for (uint64_t j = 0; j < fill->config.inner.p; j++)
+        {
+            fill->data[i].innerArray[j] = getNext(j, fill->config.inner.p);
+        }
+    }
+}
+
+// Bytes from one inner array's start to the next one's in a slab.
+static inline uint64_t getInnerStride(const ConfigT config)
+{
+    const uint64_t bytes = sizeof(uint64_t) * config.inner.p;
+    const uint64_t alignment = config.layout == LAYOUT_PAGE ? PAGE_BYTES_4K : (config.layout == LAYOUT_LINE ? CACHE_LINE_BYTES : sizeof(uint64_t));
+    return (bytes + alignment - 1ull) / alignment * alignment + config.padLines * CACHE_LINE_BYTES;
+}
+
+static inline uint64_t getInnerBytes(const ConfigT config)
+{
+    return config.layout == LAYOUT_MALLOC ? sizeof(uint64_t) * config.inner.p * config.outer.p : getInnerStride(config) * config.outer.p;
+}
+
+// A slab on malloc pages still starts on a page, so that every layout keeps
+// its alignment.
+static inline uint64_t *allocateSlab(const ConfigT config)
+{
+    const uint64_t bytes = getInnerBytes(config);
+    if (config.pages != PAGES_MALLOC)
+    {
+        return pagesAlloc(bytes, config.pages, config.populate);
+    }
+    uint64_t *slab = aligned_alloc(PAGE_BYTES_4K, (bytes + PAGE_BYTES_4K - 1ull) & ~(PAGE_BYTES_4K - 1ull));
+    if (config.populate)
+    {
+        memset(slab, 0, bytes);
+    }
+    return slab;
+}
+
 static inline OuterNodeT *init(const ConfigT config)
 {
-    OuterNodeT *data = malloc(sizeof(OuterNodeT) * config.outer.p);
-    for (uint64_t i = 0; i < config.outer.p; i++)
+    OuterNodeT *data = pagesAlloc(sizeof(OuterNodeT) * config.outer.p, config.pages, config.populate);
+    if (config.layout == LAYOUT_MALLOC)
     {
-        data[i].innerArray = malloc(sizeof(uint64_t) * config.inner.p);
+        // Allocation stays serial so that placement follows malloc's usual order.
+        for (uint64_t i = 0; i < config.outer.p; i++)
+        {
+            data[i].innerArray = malloc(sizeof(uint64_t) * config.inner.p);
+        }
     }
-    uint64_t outerIndex = 1ull;
-    for (uint64_t i = 0; i < config.outer.p; i++)
+    else
     {
-        const uint64_t nextOuterIndex = getNext(outerIndex, config.outer.p);
-        data[outerIndex].nextIndex = nextOuterIndex;
-        uint64_t innerIndex = 1ull;
-        for (uint64_t j = 0; j < config.inner.p; j++)
+        char *slab = (char *)allocateSlab(config);
+        const uint64_t stride = getInnerStride(config);
+        for (uint64_t i = 0; i < config.outer.p; i++)
         {
-            const uint64_t nextInnerIndex = getNext(innerIndex, config.inner.p);
-            data[outerIndex].innerArray[innerIndex] = nextInnerIndex;
-            innerIndex = nextInnerIndex;
+            data[i].innerArray = (uint64_t *)(slab + i * stride);
         }
-        outerIndex = nextOuterIndex;
     }
+    CycleFillT fill = {config, data};
+    parallelFor(config.outer.p, config.initThreads, fillCycleRange, &fill);
     return data;
 }
 
+// A slab goes in one free: array 0 sits at its start.
 static inline void deallocate(const ConfigT config, OuterNodeT *data)
 {
-    for (uint64_t i = 0; i < config.outer.p; i++)
+    if (config.layout != LAYOUT_MALLOC)
+    {
+        pagesFree(data[0].innerArray);
+    }
+    else
     {
-        free(data[i].innerArray);
+        for (uint64_t i = 0; i < config.outer.p; i++)
+        {
+            free(data[i].innerArray);
+        }
     }
-    free(data);
+    pagesFree(data);
 }
 
-static inline ResultT traverse(const ConfigT config, OuterNodeT *data)
+// Prefetches the first p elements' cache lines.
+static ALWAYS_INLINE void prefetchInnerArray(const uint64_t *innerArray, const uint64_t p)
 {
+    for (uint64_t offset = 0; offset < p; offset += 8)
+    {
+        __builtin_prefetch(innerArray + offset);
+    }
+}
+
+// For PREFETCH_AHEAD, a second cursor runs prefetchDistance outer nodes ahead
+// of the walk and prefetches that node's whole inner array, along with the
+// outer node after it so the cursor's own next step is already cached.
+// Distance 0 falls back to no prefetch. Each strategy is its own kernel.
+static ALWAYS_INLINE ResultT traverseStrategy(const ConfigT config, OuterNodeT *data, const PrefetchStrategyT strategy)
+{
+    const int ahead = strategy == PREFETCH_AHEAD && config.prefetchDistance > 0;
+    const uint64_t linesP = MIN(config.prefetchLines * 8ull, config.inner.p);
     double nsPerAccess = DBL_MAX;
+    PerfSampleT perAccess = perfNone();
     uint64_t loopSum = 0ull;
+    const uint64_t accesses = config.inner.totalAccesses * config.outer.totalAccesses;
+    TrialSamplesT samples = {{0.0}, 0u, 0.0};
 
-    for (int trial = 0; trial < config.trials; trial++)
+    while (!trialsDone(&samples, config.policy))
     {
         loopSum = 0ull;
         uint64_t innerIndex = 1ull;
         uint64_t outerIndex = 1ull;
+        uint64_t aheadIndex = outerIndex;
+        perfStart(config.counters);
         const fasttime_t t1 = gettime();
+        for (uint64_t i = 0; ahead && i < config.prefetchDistance; i++)
+        {
+            aheadIndex = data[aheadIndex].nextIndex;
+        }
 
         for (uint64_t i = 0; i < config.outer.totalAccesses; i++)
         {
             uint64_t *innerArray = data[outerIndex].innerArray;
-            // --------------------------- //
-            // Put prefetch code here
-            // --------------------------- //
+            if (strategy == PREFETCH_WHOLE)
+            {
+                prefetchInnerArray(innerArray, config.inner.p);
+            }
+            else if (strategy == PREFETCH_LINES)
+            {
+                prefetchInnerArray(innerArray, linesP);
+            }
+            else if (ahead)
+            {
+                prefetchInnerArray(data[aheadIndex].innerArray, config.inner.p);
+                aheadIndex = data[aheadIndex].nextIndex;
+                __builtin_prefetch(&data[aheadIndex]);
+            }
             for (uint64_t j = 0; j < config.inner.totalAccesses; j++)
             {
                 loopSum += innerArray[innerIndex];
@@ -123,35 +274,273 @@ static inline ResultT traverse(const ConfigT config, OuterNodeT *data)
             outerIndex = data[outerIndex].nextIndex;
         }
         const fasttime_t t2 = gettime();
-        nsPerAccess = MIN((tdiff(t1, t2) * 1e9) / (config.inner.totalAccesses * config.outer.totalAccesses), nsPerAccess);
+        const PerfSampleT sample = perfStop(config.counters);
+        const double trialNsPerAccess = (tdiff(t1, t2) * 1e9) / accesses;
+        trialSamplesAdd(&samples, trialNsPerAccess, tdiff(t1, t2) * 1e3);
+        if (trialNsPerAccess < nsPerAccess)
+        {
+            nsPerAccess = trialNsPerAccess;
+            perAccess = perfPerAccess(sample, (double)accesses);
+        }
+    }
+    const uint64_t peakBytes = sizeof(OuterNodeT) * config.outer.p + getInnerBytes(config);
+    return (ResultT){loopSum, nsPerAccess, peakBytes / 1024ull, perAccess, trialStatsCompute(&samples), latencyNone()};
+}
+
+static inline ResultT traverse(const ConfigT config, OuterNodeT *data)
+{
+    switch (config.enablePrefetch)
+    {
+    case PREFETCH_WHOLE:
+        return traverseStrategy(config, data, PREFETCH_WHOLE);
+    case PREFETCH_LINES:
+        return traverseStrategy(config, data, PREFETCH_LINES);
+    case PREFETCH_AHEAD:
+        return traverseStrategy(config, data, PREFETCH_AHEAD);
+    default:
+        return traverseStrategy(config, data, PREFETCH_NONE);
+    }
+}
+
+// A cached dataset remembers the config it was built with, which is what
+// deallocate needs, and the snapshot it was mapped from, if any.
+typedef struct
+{
+    ConfigT config;
+    OuterNodeT *data;
+    SnapshotT snapshot;
+} CachedDataT;
+
+static void destroyData(void *cached)
+{
+    CachedDataT *entry = cached;
+    if (entry->snapshot.mapping)
+    {
+        snapshotUnmap(&entry->snapshot);
+    }
+    else
+    {
+        deallocate(entry->config, entry->data);
+    }
+    free(entry);
+}
+
+// A snapshot holds the outer nodes, with each inner array pointer stored as
+// its byte offset into the slab, followed by the slab. Mapping it only
+// rewrites the outer nodes; the slab is used in place. Only slab layouts on
+// malloc pages can be mapped, the rest always build.
+static inline CachedDataT *loadData(const ConfigT config)
+{
+    CachedDataT *entry = calloc(1, sizeof(CachedDataT));
+    entry->config = config;
+    entry->config.snapshotDir = NULL; // Freed with the args line
+    const DatasetKeyT key = {{config.inner.p, config.outer.p, config.layout, config.padLines}};
+    const int snapshot = config.snapshotDir && config.layout != LAYOUT_MALLOC;
+    char *path = snapshot ? snapshotPath(config.snapshotDir, "bulk", &key) : NULL;
+    const uint64_t bytes[] = {sizeof(OuterNodeT) * config.outer.p, getInnerBytes(config)};
+    if (path && config.pages == PAGES_MALLOC)
+    {
+        entry->snapshot = snapshotMap(path, &key, config.populate);
+    }
+    if (entry->snapshot.mapping)
+    {
+        entry->data = entry->snapshot.sections[0];
+        char *slab = entry->snapshot.sections[1];
+        for (uint64_t i = 0; i < config.outer.p; i++)
+        {
+            entry->data[i].innerArray = (uint64_t *)(slab + (uintptr_t)entry->data[i].innerArray);
+        }
+    }
+    else
+    {
+        entry->data = init(config);
+        if (path)
+        {
+            OuterNodeT *relative = malloc(bytes[0]);
+            for (uint64_t i = 0; i < config.outer.p; i++)
+            {
+                relative[i].nextIndex = entry->data[i].nextIndex;
+                relative[i].innerArray = (uint64_t *)((char *)entry->data[i].innerArray - (char *)entry->data[0].innerArray);
+            }
+            const void *sections[] = {relative, entry->data[0].innerArray};
+            snapshotWrite(path, &key, 2u, sections, bytes);
+            free(relative);
+        }
+    }
+    free(path);
+    return entry;
+}
+
+// The cycles are only read, so lines that share their shape share one copy.
+// initMs is allocation plus fill (or mapping a snapshot), so that layouts can
+// be compared on setup cost, and 0 when the dataset was already resident.
+static inline OuterNodeT *getData(const ConfigT config, double *initMs)
+{
+    const DatasetKeyT key = {{config.inner.p, config.outer.p, config.layout, config.padLines, config.pages, config.populate}};
+    const CachedDataT *cached = datasetCacheGet(&key);
+    *initMs = 0.0;
+    if (!cached)
+    {
+        const uint64_t bytes = sizeof(OuterNodeT) * config.outer.p + getInnerBytes(config);
+        datasetCacheReserve(bytes);
+        const fasttime_t t1 = gettime();
+        CachedDataT *entry = loadData(config);
+        *initMs = tdiff(t1, gettime()) * 1e3;
+        datasetCachePut(&key, entry, bytes, destroyData);
+        cached = entry;
+    }
+    return cached->data;
+}
+
+// The walk of traverseStrategy with every Nth inner access timed on its own.
+// The strategy is a run-time choice here, since only the sampled accesses
+// are of interest.
+static uint64_t traverseSampled(const ConfigT config, OuterNodeT *data, LatencyHistogramT *histogram)
+{
+    const int ahead = config.enablePrefetch == PREFETCH_AHEAD && config.prefetchDistance > 0;
+    const uint64_t linesP = MIN(config.prefetchLines * 8ull, config.inner.p);
+    uint64_t loopSum = 0ull;
+    uint64_t innerIndex = 1ull;
+    uint64_t outerIndex = 1ull;
+    uint64_t aheadIndex = outerIndex;
+    uint64_t countdown = config.latencyEvery;
+    for (uint64_t i = 0; ahead && i < config.prefetchDistance; i++)
+    {
+        aheadIndex = data[aheadIndex].nextIndex;
+    }
+    for (uint64_t i = 0; i < config.outer.totalAccesses; i++)
+    {
+        uint64_t *innerArray = data[outerIndex].innerArray;
+        if (config.enablePrefetch == PREFETCH_WHOLE)
+        {
+            prefetchInnerArray(innerArray, config.inner.p);
+        }
+        else if (config.enablePrefetch == PREFETCH_LINES)
+        {
+            prefetchInnerArray(innerArray, linesP);
+        }
+        else if (ahead)
+        {
+            prefetchInnerArray(data[aheadIndex].innerArray, config.inner.p);
+            aheadIndex = data[aheadIndex].nextIndex;
+            __builtin_prefetch(&data[aheadIndex]);
+        }
+        for (uint64_t j = 0; j < config.inner.totalAccesses; j++)
+        {
+            uint64_t next;
+            if (--countdown == 0ull)
+            {
+                countdown = config.latencyEvery;
+                const fasttime_t t1 = gettime();
+                next = innerArray[innerIndex];
+                const fasttime_t t2 = gettime();
+                latencyHistogramAdd(histogram, t1, t2);
+            }
+            else
+            {
+                next = innerArray[innerIndex];
+            }
+            loopSum += next;
+            innerIndex = next;
+        }
+        outerIndex = data[outerIndex].nextIndex;
+    }
+    return loopSum;
+}
+
+// Every sampled pass has to produce the trials' loopSum, which also keeps
+// its loads from being optimized away.
+static inline LatencySummaryT testLatency(const ConfigT config, OuterNodeT *data, const ResultT result)
+{
+    if (config.latencyEvery == 0ull)
+    {
+        return latencyNone();
+    }
+    const uint64_t accesses = config.inner.totalAccesses * config.outer.totalAccesses;
+    const uint64_t passes = latencyGetPasses(accesses, config.latencyEvery);
+    LatencyHistogramT histogram;
+    latencyHistogramReset(&histogram);
+    const fasttime_t t1 = gettime();
+    uint64_t mismatches = 0ull;
+    for (uint64_t pass = 0ull; pass < passes; pass++)
+    {
+        mismatches += traverseSampled(config, data, &histogram) != result.loopSum;
+    }
+    const fasttime_t t2 = gettime();
+    if (mismatches)
+    {
+        fprintf(stderr, "latencyEvery: %" PRIu64 " sampled passes did not match loopSum\n", mismatches);
     }
-    return (ResultT){loopSum, nsPerAccess};
+    return latencySummarize(&histogram, config.latencyEvery, tdiff(t1, t2) * 1e9 / (double)(passes * accesses), result.nsPerAccess);
 }
 
-static inline ResultT testTraversal(const ConfigT config)
+static inline ResultT testTraversal(const ConfigT config, double *initMs)
 {
-    OuterNodeT *data = init(config);
-    const ResultT result = traverse(config, data);
-    deallocate(config, data);
+    OuterNodeT *data = getData(config, initMs);
+    ResultT result = traverse(config, data);
+    result.latency = testLatency(config, data, result);
     return result;
 }
 
+// --autotune keeps one dataset resident per args line and searches distances
+// up to MAX_AUTOTUNE_DISTANCE outer steps, 0 meaning no prefetch; each
+// evaluation is a full set of trials. Only the ahead strategy has a distance,
+// so lines with any other enablePrefetch run once, as given.
+#define MAX_AUTOTUNE_DISTANCE 64ull
+
+typedef struct
+{
+    ConfigT config;
+    OuterNodeT *data;
+    ResultT best;
+} BulkAutotuneT;
+
+static double traversalCost(void *context, uint64_t distance)
+{
+    BulkAutotuneT *tune = context;
+    tune->config.prefetchDistance = distance;
+    const ResultT result = traverse(tune->config, tune->data);
+    if (result.nsPerAccess < tune->best.nsPerAccess)
+    {
+        tune->best = result;
+    }
+    return result.nsPerAccess;
+}
+
+static inline ResultT autotuneTraversal(ConfigT *config, double *initMs)
+{
+    if (config->enablePrefetch != PREFETCH_AHEAD)
+    {
+        return testTraversal(*config, initMs);
+    }
+    OuterNodeT *data = getData(*config, initMs);
+    BulkAutotuneT tune = {.config = *config, .data = data, .best = {.nsPerAccess = DBL_MAX}};
+    const AutotuneT search = autotuneDistance(0ull, MAX_AUTOTUNE_DISTANCE, traversalCost, &tune);
+    config->prefetchDistance = search.bestDistance;
+    tune.best.latency = testLatency(*config, data, tune.best);
+    return tune.best;
+}
+
 #define BOUND(x, min, max) ((x) <= (min) ? (min) : ((x) >= (max) ? (max) : (x)))
 
 int main(int argc, char *argv[])
 {
     uint64_t primes[] = {29, 61, 107, 227, 509, 947, 2029, 4093, 8179, 16363, 32749, 65371, 131059, 262139, 524269, 1048571, 2097133, 4194187, 8388587};
+    assert(cyclePrimesTableIsValid(primes, sizeof(primes) / sizeof(primes[0]), 5ull)); // primes[i] belongs to 2^(i + 5)
   
-    if (argc == 2)
+    // ./bulk_prefetch total_bytes_log total_accesses inner_bytes_log inner_accesses enable_prefetch{0:none,1:whole,2:lines,3:ahead} trials
+    //                   [prefetchLines=N] [prefetchDistance=N] [layout=malloc|packed|line|page] [padLines=N] [cacheMB=N] [snapshotDir=path] [ciPercent=X] [budgetMs=N] [latencyEvery=N] [totalKB=N] [initThreads=N] [counters=0|1] [pages=malloc|4k|thp|2m|1g] [populate=0|1]
+    // ./bulk_prefetch --autotune args_file searches the prefetch distance for every line instead.
+    const int autotune = argc == 3 && strcmp(argv[1], "--autotune") == 0;
+    if (argc == 2 || autotune)
     {
-              
-        FILE *fp = fopen(argv[1], "r");
+        FILE *fp = fopen(argv[argc - 1], "r");
         if (!fp) {
-            printf("Could not open file %s\n", argv[1]);
+            printf("Could not open file %s\n", argv[argc - 1]);
             return 1;
         }
 
-        char line[256];
+        char line[1024];
         while (fgets(line, sizeof(line), fp)) {
             ConfigT config;
             uint64_t totalElementsLog, totalAccesses, innerElementsLog;
@@ -166,26 +555,52 @@ int main(int argc, char *argv[])
                 innerElementsLog = BOUND(innerElementsLog, 8, 15) - 3;
                 config.inner.p = primes[innerElementsLog - 5];
                 config.outer.p = primes[totalElementsLog - innerElementsLog - 5];
+                if (findOption(line, "totalKB"))
+                {
+                    // Any size between the table's, for sampling around cache boundaries.
+                    const uint64_t outerP = getOptionVal(line, "totalKB", 0ull, 0ull, 1ull << 18) * 128ull / config.inner.p;
+                    config.outer.p = MAX(cyclePrimeAtMost(outerP), primes[0]);
+                }
                 config.inner.totalAccesses = BOUND(config.inner.totalAccesses, 1, 1024);
                 config.outer.totalAccesses = totalAccesses / config.inner.totalAccesses;
-                config.enablePrefetch = BOUND(enablePrefetch, 0, 1);
+                config.enablePrefetch = BOUND(enablePrefetch, PREFETCH_NONE, PREFETCH_AHEAD);
+                config.prefetchLines = getOptionVal(line, "prefetchLines", 2ull, 1ull, (config.inner.p + 7ull) / 8ull);
+                config.prefetchDistance = getOptionVal(line, "prefetchDistance", 1ull, 0ull, config.outer.p);
                 config.trials = BOUND(trials, 1, 100);
+                config.policy = getTrialPolicy(line, config.trials);
+                config.latencyEvery = getOptionVal(line, "latencyEvery", 0ull, 0ull, UINT64_MAX);
+                config.initThreads = getOptionVal(line, "initThreads", getDefaultInitThreads(), 1ull, MAX_INIT_THREADS);
+                config.counters = getOptionVal(line, "counters", 0ull, 0ull, 1ull);
+                config.pages = pagesResolve(getOptionChoice(line, "pages", pageModeNames, NUM_PAGE_MODES, PAGES_MALLOC));
+                config.populate = getOptionVal(line, "populate", 0ull, 0ull, 1ull);
+                config.layout = getOptionChoice(line, "layout", layoutNames, NUM_LAYOUTS, LAYOUT_MALLOC);
+                // Page backing other than malloc needs a slab.
+                config.layout = config.pages != PAGES_MALLOC && config.layout == LAYOUT_MALLOC ? LAYOUT_PACKED : config.layout;
+                config.padLines = config.layout == LAYOUT_MALLOC ? 0ull : getOptionVal(line, "padLines", 0ull, 0ull, 64ull);
+                config.snapshotDir = getOptionString(line, "snapshotDir");
+                if (findOption(line, "cacheMB"))
+                {
+                    datasetCacheSetBudget(getOptionVal(line, "cacheMB", 0ull, 0ull, UINT64_MAX >> 20) << 20);
+                }
 
-                const ResultT result = testTraversal(config);
+                double initMs = 0.0;
+                const ResultT result = autotune ? autotuneTraversal(&config, &initMs) : testTraversal(config, &initMs);
                 char *configString = configToString(config);
                 char *resultString = resultToString(result);
-                printf("%s,%s\n", configString, resultString);
+                printf("%s,%s,%f\n", configString, resultString, initMs);
                 free(configString);
                 free(resultString);
+                free(config.snapshotDir);
             }
         }
 
         fclose(fp);
+        datasetCacheClear();
         return 0;
     }
     char *configHeader = getConfigHeader();
     char *resultHeader = getResultHeader();
-    printf("%s,%s\n", configHeader, resultHeader);
+    printf("%s,%s,initMs\n", configHeader, resultHeader);
     free(configHeader);
     free(resultHeader);
     return 0;
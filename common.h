@@ -1,6 +1,9 @@
 #pragma once
 
 #include <inttypes.h>
+#include "perf_counters.h"
+#include "trial_stats.h"
+#include "latency_histogram.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -32,14 +35,113 @@ typedef struct
 {
     uint64_t loopSum;
     double nsPerAccess;
+    uint64_t peakKB; // Benchmark-owned allocations at their high-water mark
+    PerfSampleT perAccess; // Counters of the fastest trial, per access
+    TrialStatsT stats;     // nsPerAccess over all trials
+    LatencySummaryT latency; // Sampled passes, if latencyEvery is set
 } ResultT;
 
 char *getResultHeader()
 {
-    return createFormattedString("loopSum,nsPerAccess");
+    return createFormattedString("loopSum,nsPerAccess,peakKB,%s,%s,%s", trialStatsGetHeader(), latencyGetHeader(), perfGetHeader());
 }
 
 char *resultToString(ResultT result)
 {
-    return createFormattedString("%" PRIu64 ",%f", result.loopSum, result.nsPerAccess);
+    char counters[256];
+    char stats[256];
+    char latency[256];
+    perfToString(result.perAccess, counters, sizeof(counters));
+    trialStatsToString(result.stats, stats, sizeof(stats));
+    latencyToString(result.latency, latency, sizeof(latency));
+    return createFormattedString("%" PRIu64 ",%f,%" PRIu64 ",%s,%s,%s", result.loopSum, result.nsPerAccess, result.peakKB, stats, latency, counters);
+}
+
+// Optional settings follow the positional fields of an args-file line as
+// "key=value" tokens, e.g. "1000 3 3 20 16 threads=4". Returns a pointer to
+// the value of the last token for key, or NULL if the line does not set it.
+const char *findOption(const char *line, const char *key)
+{
+    const size_t keyLength = strlen(key);
+    const char *found = NULL;
+    const char *token = line;
+    while (*token)
+    {
+        token += strspn(token, " \t\r\n");
+        const size_t tokenLength = strcspn(token, " \t\r\n");
+        if (tokenLength > keyLength && strncmp(token, key, keyLength) == 0 && token[keyLength] == '=')
+        {
+            found = token + keyLength + 1;
+        }
+        token += tokenLength;
+    }
+    return found;
+}
+
+uint64_t getOptionVal(const char *line, const char *key, uint64_t defaultVal, uint64_t minVal, uint64_t maxVal)
+{
+    const char *value = findOption(line, key);
+    if (!value)
+    {
+        return defaultVal;
+    }
+    const uint64_t val = strtoull(value, NULL, 10);
+    return MIN(MAX(val, minVal), maxVal);
+}
+
+double getOptionDouble(const char *line, const char *key, double defaultVal, double minVal, double maxVal)
+{
+    const char *value = findOption(line, key);
+    if (!value)
+    {
+        return defaultVal;
+    }
+    const double val = strtod(value, NULL);
+    return MIN(MAX(val, minVal), maxVal);
+}
+
+// trials as given, made adaptive by ciPercent=X (target 95% CI half-width, in
+// percent of the mean) within budgetMs=N of trial time (default 10000).
+TrialPolicyT getTrialPolicy(const char *line, uint32_t trials)
+{
+    TrialPolicyT policy;
+    policy.trials = trials;
+    policy.ciPercent = getOptionDouble(line, "ciPercent", 0.0, 0.0, 100.0);
+    policy.budgetMs = (double)getOptionVal(line, "budgetMs", 10000ull, 1ull, UINT64_MAX);
+    return policy;
+}
+
+// Returns a malloc'd copy of the value of key, or NULL.
+char *getOptionString(const char *line, const char *key)
+{
+    const char *value = findOption(line, key);
+    if (!value)
+    {
+        return NULL;
+    }
+    const size_t valueLength = strcspn(value, " \t\r\n");
+    char *copy = malloc(valueLength + 1);
+    memcpy(copy, value, valueLength);
+    copy[valueLength] = '\0';
+    return copy;
+}
+
+// Maps the value of key onto an index into names, for enum-like settings.
+int getOptionChoice(const char *line, const char *key, const char *const *names, int numNames, int defaultChoice)
+{
+    const char *value = findOption(line, key);
+    if (!value)
+    {
+        return defaultChoice;
+    }
+    const size_t valueLength = strcspn(value, " \t\r\n");
+    for (int i = 0; i < numNames; i++)
+    {
+        if (strlen(names[i]) == valueLength && strncmp(value, names[i], valueLength) == 0)
+        {
+            return i;
+        }
+    }
+    assert(0); // Unsupported option value
+    return defaultChoice;
 }
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <emmintrin.h>
+
+// Cache-conscious stand-ins for std::unordered_map and std::map, keyed and
+// valued by uint64_t. They only offer what the traversals use: operator[],
+// which inserts a zero value for a missing key. None of them allocates a
+// node per element, so an access costs the container's probe or descent
+// rather than an extra pointer chase.
+
+// Fibonacci hashing, so that the dense integer keys the traversals use are
+// spread across the table instead of landing in sequential slots.
+static inline uint64_t hashKey(const uint64_t key) { return key * 0x9e3779b97f4a7c15ull; }
+
+static inline uint64_t getTableLog(const uint64_t capacityHint)
+{
+    uint64_t log = 4;
+    while ((1ull << log) < 2 * capacityHint)
+    {
+        log++;
+    }
+    return log;
+}
+
+// Open addressing with linear probing over interleaved key/value slots, four
+// to a cache line. Kept at most half full, growing when needed.
+class FlatHashMapT
+{
+    static constexpr uint64_t EMPTY = UINT64_MAX;
+
+    struct SlotT
+    {
+        uint64_t key;
+        uint64_t value;
+    };
+
+    std::vector<SlotT> slots;
+    uint64_t log;
+    uint64_t size = 0;
+
+    uint64_t getHome(const uint64_t key) const { return hashKey(key) >> (64 - log); }
+
+    void grow()
+    {
+        std::vector<SlotT> old(1ull << (log + 1), SlotT{EMPTY, 0});
+        old.swap(slots);
+        log++;
+        for (const SlotT &slot : old)
+        {
+            if (slot.key != EMPTY)
+            {
+                uint64_t i = getHome(slot.key);
+                while (slots[i].key != EMPTY)
+                {
+                    i = (i + 1) & (slots.size() - 1);
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+
+public:
+    explicit FlatHashMapT(const uint64_t capacityHint = 0) : slots(1ull << getTableLog(capacityHint), SlotT{EMPTY, 0}), log(getTableLog(capacityHint)) {}
+
+    uint64_t &operator[](const uint64_t key)
+    {
+        assert(key != EMPTY);
+        const uint64_t mask = slots.size() - 1;
+        uint64_t i = getHome(key);
+        for (; slots[i].key != EMPTY; i = (i + 1) & mask)
+        {
+            if (slots[i].key == key)
+            {
+                return slots[i].value;
+            }
+        }
+        if (2 * (size + 1) > slots.size())
+        {
+            grow();
+            return (*this)[key];
+        }
+        size++;
+        slots[i] = SlotT{key, 0};
+        return slots[i].value;
+    }
+};
+
+// Swiss-table style probing: a separate array of one control byte per slot
+// (the top 7 bits of the hash, or EMPTY) is searched 16 slots at a time with
+// SSE2, and only slots whose control byte matches are compared by key. Groups
+// are probed in sequence from the key's home group, taken from the bits just
+// below the tag so that the two stay independent; the multiplicative hash
+// mixes its high bits best.
+class GroupHashMapT
+{
+    static constexpr uint64_t GROUP = 16;
+    static constexpr int8_t EMPTY = -128;
+
+    struct SlotT
+    {
+        uint64_t key;
+        uint64_t value;
+    };
+
+    std::vector<int8_t> control;
+    std::vector<SlotT> slots;
+    uint64_t log;
+    uint64_t size = 0;
+
+    uint64_t getHomeGroup(const uint64_t hash) const { return (hash >> (57 - log)) & (control.size() - 1) & ~(GROUP - 1); }
+    static int8_t getTag(const uint64_t hash) { return static_cast<int8_t>(hash >> 57); }
+
+    void grow()
+    {
+        std::vector<int8_t> oldControl(1ull << (log + 1), EMPTY);
+        std::vector<SlotT> oldSlots(1ull << (log + 1));
+        oldControl.swap(control);
+        oldSlots.swap(slots);
+        log++;
+        size = 0;
+        for (uint64_t i = 0; i < oldSlots.size(); i++)
+        {
+            if (oldControl[i] != EMPTY)
+            {
+                (*this)[oldSlots[i].key] = oldSlots[i].value;
+            }
+        }
+    }
+
+public:
+    explicit GroupHashMapT(const uint64_t capacityHint = 0)
+        : control(1ull << getTableLog(capacityHint), EMPTY), slots(1ull << getTableLog(capacityHint)), log(getTableLog(capacityHint)) {}
+
+    uint64_t &operator[](const uint64_t key)
+    {
+        const uint64_t hash = hashKey(key);
+        const __m128i tag = _mm_set1_epi8(getTag(hash));
+        const __m128i empty = _mm_set1_epi8(EMPTY);
+        const uint64_t mask = control.size() - 1;
+        for (uint64_t group = getHomeGroup(hash);; group = (group + GROUP) & mask)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&control[group]));
+            for (uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, tag)); matches; matches &= matches - 1)
+            {
+                const uint64_t i = group + __builtin_ctz(matches);
+                if (slots[i].key == key)
+                {
+                    return slots[i].value;
+                }
+            }
+            const uint32_t empties = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, empty));
+            if (empties)
+            {
+                if (2 * (size + 1) > slots.size())
+                {
+                    grow();
+                    return (*this)[key];
+                }
+                const uint64_t i = group + __builtin_ctz(empties);
+                size++;
+                control[i] = getTag(hash);
+                slots[i] = SlotT{key, 0};
+                return slots[i].value;
+            }
+        }
+    }
+};
+
+// B+tree whose nodes are exactly one cache line: inner nodes hold 7 32-bit
+// separator keys and 8 child indices, leaves hold 5 32-bit keys and their
+// values. Nodes live in two pools and refer to each other by index, so a
+// lookup is one line per level. Keys must fit in 32 bits.
+class BTreeT
+{
+    static constexpr uint32_t INNER_KEYS = 7;
+    static constexpr uint32_t LEAF_KEYS = 5;
+
+    struct alignas(64) InnerT
+    {
+        uint32_t numKeys;
+        uint32_t keys[INNER_KEYS];
+        uint32_t children[INNER_KEYS + 1];
+    };
+
+    struct alignas(64) LeafT
+    {
+        uint32_t numKeys;
+        uint32_t keys[LEAF_KEYS];
+        uint64_t values[LEAF_KEYS];
+    };
+
+    static_assert(sizeof(InnerT) == 64 && sizeof(LeafT) == 64);
+
+    struct SplitT
+    {
+        bool split;
+        uint32_t key;
+        uint32_t node;
+    };
+
+    std::vector<InnerT> inners;
+    std::vector<LeafT> leaves;
+    uint32_t root = 0;
+    uint32_t height = 0; // Inner levels above the leaves
+
+    // Index of the child that covers key: the number of separators <= key.
+    static uint32_t getChild(const InnerT &inner, const uint32_t key)
+    {
+        uint32_t c = 0;
+        while (c < inner.numKeys && inner.keys[c] <= key)
+        {
+            c++;
+        }
+        return c;
+    }
+
+    SplitT insertLeaf(const uint32_t index, const uint32_t key)
+    {
+        uint32_t keys[LEAF_KEYS + 1];
+        uint64_t values[LEAF_KEYS + 1];
+        const LeafT &leaf = leaves[index];
+        uint32_t n = 0;
+        uint32_t i = 0;
+        for (; i < leaf.numKeys && leaf.keys[i] < key; i++, n++)
+        {
+            keys[n] = leaf.keys[i];
+            values[n] = leaf.values[i];
+        }
+        keys[n] = key;
+        values[n++] = 0;
+        for (; i < leaf.numKeys; i++, n++)
+        {
+            keys[n] = leaf.keys[i];
+            values[n] = leaf.values[i];
+        }
+        if (n <= LEAF_KEYS)
+        {
+            fillLeaf(leaves[index], keys, values, n);
+            return SplitT{false, 0, 0};
+        }
+        const uint32_t half = n / 2;
+        leaves.push_back(LeafT{});
+        fillLeaf(leaves[index], keys, values, half);
+        fillLeaf(leaves.back(), keys + half, values + half, n - half);
+        return SplitT{true, keys[half], static_cast<uint32_t>(leaves.size() - 1)};
+    }
+
+    static void fillLeaf(LeafT &leaf, const uint32_t *keys, const uint64_t *values, const uint32_t n)
+    {
+        leaf.numKeys = n;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            leaf.keys[i] = keys[i];
+            leaf.values[i] = values[i];
+        }
+    }
+
+    SplitT insert(const uint32_t index, const uint32_t level, const uint32_t key)
+    {
+        if (level == 0)
+        {
+            return insertLeaf(index, key);
+        }
+        const uint32_t c = getChild(inners[index], key);
+        const SplitT below = insert(inners[index].children[c], level - 1, key);
+        if (!below.split)
+        {
+            return below;
+        }
+        const InnerT &inner = inners[index];
+        // The split child is followed by its new sibling, and the separator
+        // between them goes in at the same position.
+        uint32_t ordered[INNER_KEYS + 2];
+        for (uint32_t i = 0, n = 0; i <= inner.numKeys; i++)
+        {
+            ordered[n++] = inner.children[i];
+            if (i == c)
+            {
+                ordered[n++] = below.node;
+            }
+        }
+        uint32_t sorted[INNER_KEYS + 1];
+        for (uint32_t i = 0, n = 0; i <= inner.numKeys; i++)
+        {
+            if (i == c)
+            {
+                sorted[n++] = below.key;
+            }
+            if (i < inner.numKeys)
+            {
+                sorted[n++] = inner.keys[i];
+            }
+        }
+        const uint32_t numKeys = inner.numKeys + 1;
+        if (numKeys <= INNER_KEYS)
+        {
+            fillInner(inners[index], sorted, ordered, numKeys);
+            return SplitT{false, 0, 0};
+        }
+        // The middle separator moves up; each half keeps the keys on its side.
+        const uint32_t middle = numKeys / 2;
+        inners.push_back(InnerT{});
+        fillInner(inners[index], sorted, ordered, middle);
+        fillInner(inners.back(), sorted + middle + 1, ordered + middle + 1, numKeys - middle - 1);
+        return SplitT{true, sorted[middle], static_cast<uint32_t>(inners.size() - 1)};
+    }
+
+    static void fillInner(InnerT &inner, const uint32_t *keys, const uint32_t *children, const uint32_t numKeys)
+    {
+        inner.numKeys = numKeys;
+        for (uint32_t i = 0; i < numKeys; i++)
+        {
+            inner.keys[i] = keys[i];
+        }
+        for (uint32_t i = 0; i <= numKeys; i++)
+        {
+            inner.children[i] = children[i];
+        }
+    }
+
+    uint64_t *find(const uint32_t key)
+    {
+        uint32_t index = root;
+        for (uint32_t level = height; level > 0; level--)
+        {
+            const InnerT &inner = inners[index];
+            index = inner.children[getChild(inner, key)];
+        }
+        LeafT &leaf = leaves[index];
+        for (uint32_t i = 0; i < leaf.numKeys; i++)
+        {
+            if (leaf.keys[i] == key)
+            {
+                return &leaf.values[i];
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    explicit BTreeT(const uint64_t capacityHint = 0)
+    {
+        leaves.reserve(capacityHint / 2 + 1);
+        inners.reserve(capacityHint / 8 + 1);
+        leaves.push_back(LeafT{});
+    }
+
+    uint64_t &operator[](const uint64_t key)
+    {
+        assert(key <= UINT32_MAX);
+        uint64_t *value = find(static_cast<uint32_t>(key));
+        if (value)
+        {
+            return *value;
+        }
+        const SplitT split = insert(root, height, static_cast<uint32_t>(key));
+        if (split.split)
+        {
+            inners.push_back(InnerT{});
+            InnerT &top = inners.back();
+            top.numKeys = 1;
+            top.keys[0] = split.key;
+            top.children[0] = root;
+            top.children[1] = split.node;
+            root = static_cast<uint32_t>(inners.size() - 1);
+            height++;
+        }
+        return *find(static_cast<uint32_t>(key));
+    }
+};
+
+// Memory resources behind the allocator-aware std::map and std::unordered_map
+// variants. ArenaT bumps through large chunks and never reuses memory, so
+// nodes sit back to back in allocation order with no malloc headers between
+// them. PoolT keeps a free list and its own arena per 16-byte size class, so
+// nodes of one size are packed together, apart from the bucket arrays, and
+// freed nodes are reused.
+class ArenaT
+{
+    std::vector<char *> chunks;
+    const size_t chunkBytes;
+    uintptr_t cursor = 0;
+    uintptr_t end = 0;
+
+public:
+    explicit ArenaT(const size_t chunkBytes = 1ull << 26) : chunkBytes(chunkBytes) {}
+    ArenaT(const ArenaT &) = delete;
+    ArenaT &operator=(const ArenaT &) = delete;
+    ~ArenaT()
+    {
+        for (char *chunk : chunks)
+        {
+            std::free(chunk);
+        }
+    }
+
+    void *allocate(const size_t bytes, const size_t align)
+    {
+        uintptr_t start = (cursor + align - 1) & ~(uintptr_t)(align - 1);
+        if (chunks.empty() || start + bytes > end)
+        {
+            const size_t size = (std::max(chunkBytes, bytes + align) + 63) & ~(size_t)63;
+            char *chunk = static_cast<char *>(std::aligned_alloc(64, size));
+            chunks.push_back(chunk);
+            cursor = reinterpret_cast<uintptr_t>(chunk);
+            end = cursor + size;
+            start = (cursor + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        cursor = start + bytes;
+        return reinterpret_cast<void *>(start);
+    }
+
+    void deallocate(void *, size_t, size_t) {}
+};
+
+class PoolT
+{
+    static constexpr size_t CLASS_BYTES = 16;
+    static constexpr size_t NUM_CLASSES = 16;
+
+    struct FreeT
+    {
+        FreeT *next;
+    };
+
+    FreeT *freeLists[NUM_CLASSES] = {};
+    ArenaT slabs[NUM_CLASSES];
+
+    static bool isPooled(const size_t bytes, const size_t align) { return bytes <= CLASS_BYTES * NUM_CLASSES && align <= CLASS_BYTES; }
+
+public:
+    PoolT() = default;
+    PoolT(const PoolT &) = delete;
+    PoolT &operator=(const PoolT &) = delete;
+
+    void *allocate(const size_t bytes, const size_t align)
+    {
+        if (!isPooled(bytes, align))
+        {
+            return ::operator new(bytes, std::align_val_t(align));
+        }
+        const size_t c = (bytes + CLASS_BYTES - 1) / CLASS_BYTES - 1;
+        if (freeLists[c])
+        {
+            FreeT *block = freeLists[c];
+            freeLists[c] = block->next;
+            return block;
+        }
+        return slabs[c].allocate((c + 1) * CLASS_BYTES, CLASS_BYTES);
+    }
+
+    // Takes the alignment allocate was given, so that every block goes back
+    // to where it came from.
+    void deallocate(void *ptr, const size_t bytes, const size_t align)
+    {
+        if (!isPooled(bytes, align))
+        {
+            ::operator delete(ptr, std::align_val_t(align));
+            return;
+        }
+        const size_t c = (bytes + CLASS_BYTES - 1) / CLASS_BYTES - 1;
+        freeLists[c] = new (ptr) FreeT{freeLists[c]};
+    }
+};
+
+// Standard allocator over one of the resources above; copies and rebinds
+// share the resource, which outlives the container.
+template <typename T, typename ResourceT>
+struct ResourceAllocatorT
+{
+    using value_type = T;
+    ResourceT *resource;
+
+    explicit ResourceAllocatorT(ResourceT *resource) : resource(resource) {}
+    template <typename U>
+    ResourceAllocatorT(const ResourceAllocatorT<U, ResourceT> &other) : resource(other.resource) {}
+    T *allocate(size_t n) { return static_cast<T *>(resource->allocate(sizeof(T) * n, alignof(T))); }
+    void deallocate(T *ptr, size_t n) { resource->deallocate(ptr, sizeof(T) * n, alignof(T)); }
+    bool operator==(const ResourceAllocatorT &other) const { return resource == other.resource; }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <inttypes.h>
+
+// The doubling walk of mlp_detective's cycle pattern and of bulk_prefetch
+// visits every index in 1 .. P - 1 only when P is a prime of which 2 is a
+// primitive root. The built-in size tables hold the largest such prime at or
+// below each power of two. Above CYCLE_PRIMES_STRIDED_MIN, where
+// mlp_detective's sizes start, P - 1 must also be coprime with 7 and 509, its
+// default strides, so that those walk every index without adjustment. These
+// find one below any size, for totalKB=N, and check the tables against it.
+#define CYCLE_PRIMES_STRIDED_MIN 512ull
+
+static inline uint64_t cyclePrimesPowMod(uint64_t base, uint64_t exponent, const uint64_t modulus)
+{
+    uint64_t result = 1ull;
+    base %= modulus;
+    while (exponent)
+    {
+        result = exponent & 1ull ? (uint64_t)((unsigned __int128)result * base % modulus) : result;
+        base = (uint64_t)((unsigned __int128)base * base % modulus);
+        exponent >>= 1ull;
+    }
+    return result;
+}
+
+static inline int cyclePrimesIsFullCycle(const uint64_t p)
+{
+    if (p < 5ull || p % 2ull == 0ull)
+    {
+        return p == 3ull;
+    }
+    for (uint64_t d = 3ull; d * d <= p; d += 2ull)
+    {
+        if (p % d == 0ull)
+        {
+            return 0;
+        }
+    }
+    // 2 generates the whole group unless 2^((p - 1) / q) is 1 for a prime
+    // factor q of p - 1.
+    uint64_t rest = p - 1ull;
+    for (uint64_t q = 2ull; q * q <= rest; q++)
+    {
+        if (rest % q == 0ull)
+        {
+            if (cyclePrimesPowMod(2ull, (p - 1ull) / q, p) == 1ull)
+            {
+                return 0;
+            }
+            while (rest % q == 0ull)
+            {
+                rest /= q;
+            }
+        }
+    }
+    return rest == 1ull || cyclePrimesPowMod(2ull, (p - 1ull) / rest, p) != 1ull;
+}
+
+// Largest such prime at or below maxP, or 3 if there is none.
+static inline uint64_t cyclePrimeAtMost(const uint64_t maxP)
+{
+    for (uint64_t p = maxP; p > 3ull; p--)
+    {
+        const int strided = p > CYCLE_PRIMES_STRIDED_MIN;
+        if ((!strided || ((p - 1ull) % 7ull != 0ull && (p - 1ull) % 509ull != 0ull)) && cyclePrimesIsFullCycle(p))
+        {
+            return p;
+        }
+    }
+    return 3ull;
+}
+
+// Whether table[i] is cyclePrimeAtMost(2^(firstLog + i)) for every entry.
+static inline int cyclePrimesTableIsValid(const uint64_t *table, const uint64_t count, const uint64_t firstLog)
+{
+    for (uint64_t i = 0ull; i < count; i++)
+    {
+        if (table[i] != cyclePrimeAtMost(1ull << (firstLog + i)))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Datasets kept resident across the lines of an args file. An entry is keyed
+// by the parameters that shape its data (size, degree, block length, seed,
+// layout, page backing), so lines that only change kernel parameters reuse
+// it. Before a new dataset is built, the least recently used entries are
+// freed until it fits in the budget; one dataset larger than the whole budget
+// is still kept until the next one is needed. Kernels must leave a dataset
+// as they found it, or reset it at the start of every trial.
+#define DATASET_KEY_WORDS 16
+#define MAX_CACHED_DATASETS 32
+
+typedef struct
+{
+    uint64_t words[DATASET_KEY_WORDS]; // Unused words stay zero
+} DatasetKeyT;
+
+typedef void (*DatasetFreeFnT)(void *dataset);
+
+typedef struct
+{
+    DatasetKeyT key;
+    void *dataset;
+    uint64_t bytes;
+    uint64_t lastUse;
+    DatasetFreeFnT freeFn;
+} DatasetEntryT;
+
+typedef struct
+{
+    int initialized;
+    DatasetEntryT entries[MAX_CACHED_DATASETS];
+    uint32_t numEntries;
+    uint64_t budgetBytes;
+    uint64_t residentBytes;
+    uint64_t clock;
+} DatasetCacheT;
+
+// A quarter of physical memory unless a line sets cacheMB=N.
+static inline DatasetCacheT *datasetCache(void)
+{
+    static DatasetCacheT cache;
+    if (!cache.initialized)
+    {
+        const long pages = sysconf(_SC_PHYS_PAGES);
+        const long pageBytes = sysconf(_SC_PAGESIZE);
+        cache.initialized = 1;
+        cache.budgetBytes = pages > 0 && pageBytes > 0 ? (uint64_t)pages * (uint64_t)pageBytes / 4ull : 1ull << 30;
+    }
+    return &cache;
+}
+
+static inline void datasetCacheSetBudget(const uint64_t budgetBytes)
+{
+    datasetCache()->budgetBytes = budgetBytes;
+}
+
+static inline void datasetCacheEvict(DatasetCacheT *cache, const uint32_t i)
+{
+    cache->entries[i].freeFn(cache->entries[i].dataset);
+    cache->residentBytes -= cache->entries[i].bytes;
+    cache->entries[i] = cache->entries[--cache->numEntries];
+}
+
+// Returns the resident dataset for key, or NULL if it has to be built.
+static inline void *datasetCacheGet(const DatasetKeyT *key)
+{
+    DatasetCacheT *cache = datasetCache();
+    for (uint32_t i = 0; i < cache->numEntries; i++)
+    {
+        if (memcmp(&cache->entries[i].key, key, sizeof(DatasetKeyT)) == 0)
+        {
+            cache->entries[i].lastUse = ++cache->clock;
+            return cache->entries[i].dataset;
+        }
+    }
+    return NULL;
+}
+
+// Frees least recently used datasets until bytes more would fit. Call it
+// before building, so that evicted datasets are gone by the time the new one
+// is allocated.
+static inline void datasetCacheReserve(const uint64_t bytes)
+{
+    DatasetCacheT *cache = datasetCache();
+    while (cache->numEntries > 0 && (cache->numEntries == MAX_CACHED_DATASETS || cache->residentBytes + bytes > cache->budgetBytes))
+    {
+        uint32_t oldest = 0;
+        for (uint32_t i = 1; i < cache->numEntries; i++)
+        {
+            oldest = cache->entries[i].lastUse < cache->entries[oldest].lastUse ? i : oldest;
+        }
+        datasetCacheEvict(cache, oldest);
+    }
+}
+
+// Hands dataset over to the cache, which frees it with freeFn when evicted.
+static inline void datasetCachePut(const DatasetKeyT *key, void *dataset, const uint64_t bytes, DatasetFreeFnT freeFn)
+{
+    datasetCacheReserve(bytes);
+    DatasetCacheT *cache = datasetCache();
+    DatasetEntryT *entry = &cache->entries[cache->numEntries++];
+    entry->key = *key;
+    entry->dataset = dataset;
+    entry->bytes = bytes;
+    entry->lastUse = ++cache->clock;
+    entry->freeFn = freeFn;
+    cache->residentBytes += bytes;
+}
+
+static inline void datasetCacheClear(void)
+{
+    DatasetCacheT *cache = datasetCache();
+    while (cache->numEntries > 0)
+    {
+        datasetCacheEvict(cache, cache->numEntries - 1u);
+    }
+}
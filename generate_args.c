@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <cpuid.h>
+
+// Writes the args files of all four benchmarks with their working-set sizes
+// placed around this machine's capacity boundaries: the data caches of cpu0
+// as sysfs lists them, and the reach of the first- and second-level data
+// TLBs, with 4 KiB pages and, when transparent huge pages are always on, with
+// huge pages. Sizes are dense from half an octave below each boundary to
+// half an octave above it, and a coarse grid keeps the plateaus in between
+// covered. Run it on the machine that will run the benchmarks.
+#define MAX_BOUNDARIES 16
+#define MAX_SIZES 256
+#define SIZE_MERGE_OCTAVES 0.1
+#define DEFAULT_L1_DTLB_ENTRIES 64ull
+#define DEFAULT_L2_DTLB_ENTRIES 1536ull
+
+typedef struct
+{
+    char name[32];
+    uint64_t bytes;
+} BoundaryT;
+
+typedef struct
+{
+    BoundaryT boundaries[MAX_BOUNDARIES];
+    uint32_t numBoundaries;
+} TopologyT;
+
+// Sizes per binary. Benchmarks that only take a power of two round to one.
+typedef struct
+{
+    const char *name;
+    const char *path;
+    uint64_t minBytes;
+    uint64_t maxBytes;
+    double denseSteps;    // Per octave, within half an octave of a boundary
+    double sparseOctaves; // Between sizes away from every boundary
+} SizeRangeT;
+
+static void addBoundary(TopologyT *topology, const char *name, const uint64_t bytes)
+{
+    if (bytes == 0ull || topology->numBoundaries == MAX_BOUNDARIES)
+    {
+        return;
+    }
+    BoundaryT *boundary = &topology->boundaries[topology->numBoundaries++];
+    snprintf(boundary->name, sizeof(boundary->name), "%s", name);
+    boundary->bytes = bytes;
+}
+
+// Reads one line of a sysfs file, without its newline; 0 if it is missing.
+static int readSysfs(const char *path, char *buffer, const size_t size)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        return 0;
+    }
+    const int read = fgets(buffer, (int)size, fp) != NULL;
+    fclose(fp);
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return read;
+}
+
+// "48K", "2048K", "105M" as bytes.
+static uint64_t parseBytes(const char *text)
+{
+    char *end;
+    const uint64_t value = strtoull(text, &end, 10);
+    return *end == 'G' ? value << 30 : (*end == 'M' ? value << 20 : (*end == 'K' ? value << 10 : value));
+}
+
+static void readCaches(TopologyT *topology)
+{
+    for (int index = 0;; index++)
+    {
+        char path[128];
+        char type[32];
+        char level[8];
+        char size[32];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if (!readSysfs(path, type, sizeof(type)))
+        {
+            break;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        const int hasLevel = readSysfs(path, level, sizeof(level));
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if (strcmp(type, "Instruction") != 0 && hasLevel && readSysfs(path, size, sizeof(size)))
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "L%s", level);
+            addBoundary(topology, name, parseBytes(size));
+        }
+    }
+}
+
+// Data TLB entries for 4 KiB pages from cpuid: leaf 0x18 on Intel, leaves
+// 0x80000005 and 0x80000006 on AMD. Hypervisors often hide both, in which
+// case typical sizes are assumed.
+static void readTlbEntries(uint64_t *l1Entries, uint64_t *l2Entries)
+{
+    unsigned int eax, ebx, ecx, edx;
+    *l1Entries = 0ull;
+    *l2Entries = 0ull;
+    if (__get_cpuid_count(0x18u, 0u, &eax, &ebx, &ecx, &edx))
+    {
+        const unsigned int maxSubleaf = eax;
+        for (unsigned int subleaf = 0u; subleaf <= maxSubleaf; subleaf++)
+        {
+            __get_cpuid_count(0x18u, subleaf, &eax, &ebx, &ecx, &edx);
+            const unsigned int type = edx & 0x1fu; // 1 data, 3 unified, 4 load-only
+            const unsigned int level = (edx >> 5u) & 0x7u;
+            const uint64_t entries = (uint64_t)(ebx >> 16u) * ecx;
+            if ((ebx & 1u) && (type == 1u || type == 3u || type == 4u))
+            {
+                uint64_t *target = level == 1u ? l1Entries : l2Entries;
+                *target = entries > *target ? entries : *target;
+            }
+        }
+    }
+    if (*l1Entries == 0ull && __get_cpuid(0x80000005u, &eax, &ebx, &ecx, &edx))
+    {
+        *l1Entries = (ebx >> 16u) & 0xffu;
+    }
+    if (*l2Entries == 0ull && __get_cpuid(0x80000006u, &eax, &ebx, &ecx, &edx))
+    {
+        *l2Entries = (ebx >> 16u) & 0xfffu;
+    }
+    *l1Entries = *l1Entries ? *l1Entries : DEFAULT_L1_DTLB_ENTRIES;
+    *l2Entries = *l2Entries ? *l2Entries : DEFAULT_L2_DTLB_ENTRIES;
+}
+
+static void readTlbs(TopologyT *topology, uint64_t l1Entries, uint64_t l2Entries)
+{
+    uint64_t detectedL1, detectedL2;
+    readTlbEntries(&detectedL1, &detectedL2);
+    l1Entries = l1Entries ? l1Entries : detectedL1;
+    l2Entries = l2Entries ? l2Entries : detectedL2;
+    const uint64_t pageBytes = (uint64_t)sysconf(_SC_PAGESIZE);
+    addBoundary(topology, "dTLB", l1Entries * pageBytes);
+    addBoundary(topology, "sTLB", l2Entries * pageBytes);
+    char enabled[64];
+    char hugeBytes[32];
+    if (readSysfs("/sys/kernel/mm/transparent_hugepage/enabled", enabled, sizeof(enabled)) && strstr(enabled, "[always]") &&
+        readSysfs("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", hugeBytes, sizeof(hugeBytes)))
+    {
+        // Second-level TLBs mostly share their entries between page sizes.
+        addBoundary(topology, "sTLB-huge", l2Entries * strtoull(hugeBytes, NULL, 10));
+    }
+}
+
+static int compareSizes(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorted sizes in range, any two at least SIZE_MERGE_OCTAVES apart.
+static uint32_t getSizes(const TopologyT *topology, const SizeRangeT range, uint64_t *sizes)
+{
+    uint64_t candidates[MAX_SIZES * 2];
+    uint32_t numCandidates = 0u;
+    for (double octave = log2((double)range.minBytes); octave <= log2((double)range.maxBytes) + 1e-9 && numCandidates < MAX_SIZES;
+         octave += range.sparseOctaves)
+    {
+        candidates[numCandidates++] = (uint64_t)exp2(octave);
+    }
+    candidates[numCandidates++] = range.maxBytes;
+    for (uint32_t i = 0; i < topology->numBoundaries; i++)
+    {
+        const double centre = log2((double)topology->boundaries[i].bytes);
+        for (double step = -range.denseSteps / 2.0; step <= range.denseSteps / 2.0 + 1e-9 && numCandidates < MAX_SIZES * 2; step += 1.0)
+        {
+            const uint64_t bytes = (uint64_t)exp2(centre + step / range.denseSteps);
+            if (bytes >= range.minBytes && bytes <= range.maxBytes)
+            {
+                candidates[numCandidates++] = bytes;
+            }
+        }
+    }
+    qsort(candidates, numCandidates, sizeof(uint64_t), compareSizes);
+    uint32_t numSizes = 0u;
+    for (uint32_t i = 0; i < numCandidates && numSizes < MAX_SIZES; i++)
+    {
+        if (numSizes == 0u || log2((double)candidates[i] / (double)sizes[numSizes - 1u]) >= SIZE_MERGE_OCTAVES)
+        {
+            sizes[numSizes++] = candidates[i];
+        }
+    }
+    return numSizes;
+}
+
+static inline uint64_t nearestLog(const uint64_t bytes, const uint64_t minLog, const uint64_t maxLog)
+{
+    const uint64_t log = (uint64_t)llround(log2((double)bytes));
+    return log < minLog ? minLog : (log > maxLog ? maxLog : log);
+}
+
+static uint32_t writeMlpDetective(FILE *fp, const uint64_t *sizes, const uint32_t numSizes)
+{
+    static const char *const traversals[] = {"a c r", "a c c", "a s c", "a m c", "a p r"};
+    uint32_t lines = 0u;
+    for (uint32_t i = 0; i < numSizes; i++)
+    {
+        const uint64_t log = nearestLog(sizes[i], 13ull, 28ull);
+        for (uint32_t t = 0; t < sizeof(traversals) / sizeof(traversals[0]); t++)
+        {
+            fprintf(fp, "%s %" PRIu64 " 0 10 totalKB=%" PRIu64 "\n", traversals[t], log, sizes[i] >> 10);
+            lines++;
+        }
+        fprintf(fp, "a s c %" PRIu64 " 4 10 totalKB=%" PRIu64 "\n", log, sizes[i] >> 10);
+        lines++;
+    }
+    return lines;
+}
+
+// The sweep buffer is a power of two, so sizes round to their nearest one.
+// The fixed distances come first, then one adaptive=1 line per size, which
+// starts its search at 64 bytes.
+static uint32_t writeSweep(FILE *fp, const uint64_t *sizes, const uint32_t numSizes)
+{
+    static const uint64_t distances[] = {0ull, 64ull, 512ull, 4096ull};
+    uint32_t lines = 0u;
+    uint64_t lastLog = 0ull;
+    for (uint32_t i = 0; i < numSizes; i++)
+    {
+        const uint64_t log = nearestLog(sizes[i], 14ull, 28ull);
+        for (uint32_t d = 0; log != lastLog && d < sizeof(distances) / sizeof(distances[0]); d++)
+        {
+            fprintf(fp, "32 %" PRIu64 " 10 %" PRIu64 "\n", log, distances[d]);
+            lines++;
+        }
+        lastLog = log;
+    }
+    lastLog = 0ull;
+    for (uint32_t i = 0; i < numSizes; i++)
+    {
+        const uint64_t log = nearestLog(sizes[i], 14ull, 28ull);
+        if (log != lastLog)
+        {
+            fprintf(fp, "32 %" PRIu64 " 10 64 adaptive=1\n", log);
+            lines++;
+        }
+        lastLog = log;
+    }
+    return lines;
+}
+
+// Mark nodes are 64 bytes.
+static uint32_t writeMark(FILE *fp, const uint64_t *sizes, const uint32_t numSizes)
+{
+    static const uint64_t distances[] = {0ull, 4ull, 16ull, 64ull, 256ull};
+    uint32_t lines = 0u;
+    for (uint32_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++)
+    {
+        for (uint32_t i = 0; i < numSizes; i++)
+        {
+            fprintf(fp, "%" PRIu64 " 3 3 20 %" PRIu64 "\n", sizes[i] / 64, distances[d]);
+            lines++;
+        }
+    }
+    return lines;
+}
+
+static uint32_t writeBulkPrefetch(FILE *fp, const uint64_t *sizes, const uint32_t numSizes)
+{
+    uint32_t lines = 0u;
+    for (uint32_t i = numSizes; i-- > 0;)
+    {
+        const uint64_t log = nearestLog(sizes[i], 15ull, 28ull);
+        for (uint64_t innerBytesLog = 8ull; innerBytesLog <= 10ull; innerBytesLog++)
+        {
+            for (uint64_t innerAccesses = 1ull; innerAccesses <= 16ull; innerAccesses *= 4ull)
+            {
+                for (uint64_t strategy = 0ull; strategy <= 3ull; strategy++)
+                {
+                    fprintf(fp, "%" PRIu64 " 1000000 %" PRIu64 " %" PRIu64 " %" PRIu64 " 10 totalKB=%" PRIu64 "\n", log, innerBytesLog,
+                            innerAccesses, strategy, sizes[i] >> 10);
+                    lines++;
+                }
+            }
+        }
+    }
+    return lines;
+}
+
+typedef uint32_t (*WriteArgsFnT)(FILE *fp, const uint64_t *sizes, const uint32_t numSizes);
+
+int main(int argc, char *argv[])
+{
+    // ./generate_args [--only mlp_detective|sweep|mark|bulk_prefetch] [--dtlb entries] [--stlb entries]
+    const char *only = NULL;
+    uint64_t l1Entries = 0ull;
+    uint64_t l2Entries = 0ull;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--only") == 0)
+        {
+            only = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--dtlb") == 0)
+        {
+            l1Entries = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--stlb") == 0)
+        {
+            l2Entries = strtoull(argv[i + 1], NULL, 10);
+        }
+    }
+
+    TopologyT topology = {.numBoundaries = 0u};
+    readCaches(&topology);
+    readTlbs(&topology, l1Entries, l2Entries);
+    for (uint32_t i = 0; i < topology.numBoundaries; i++)
+    {
+        printf("%s: %" PRIu64 " KB\n", topology.boundaries[i].name, topology.boundaries[i].bytes >> 10);
+    }
+
+    // Ranges follow what each benchmark accepts; bulk_prefetch runs 36
+    // variants per size, so it is sampled more coarsely, and from 32 KB so
+    // that the largest inner arrays still leave room for an outer cycle.
+    static const SizeRangeT ranges[] = {
+        {"mlp_detective", "mlp_detective_args.txt", 8ull << 10, 256ull << 20, 4.0, 2.0},
+        {"sweep", "sweep_args.txt", 16ull << 10, 256ull << 20, 2.0, 2.0},
+        {"mark", "mark_args.txt", 64ull << 10, 256ull << 20, 4.0, 2.0},
+        {"bulk_prefetch", "bulk_prefetch_args.txt", 32ull << 10, 256ull << 20, 2.0, 3.0},
+    };
+    static const WriteArgsFnT writers[] = {writeMlpDetective, writeSweep, writeMark, writeBulkPrefetch};
+    for (uint32_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        if (only && strcmp(only, ranges[r].name) != 0)
+        {
+            continue;
+        }
+        uint64_t sizes[MAX_SIZES];
+        const uint32_t numSizes = getSizes(&topology, ranges[r], sizes);
+        FILE *fp = fopen(ranges[r].path, "w");
+        if (!fp)
+        {
+            printf("Could not open file %s\n", ranges[r].path);
+            return 1;
+        }
+        const uint32_t lines = writers[r](fp, sizes, numSizes);
+        fclose(fp);
+        printf("%s: %" PRIu32 " sizes, %" PRIu32 " lines\n", ranges[r].path, numSizes, lines);
+    }
+    return 0;
+}
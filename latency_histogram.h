@@ -0,0 +1,152 @@
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "fasttime.h"
+
+// Sampled per-access latencies. With latencyEvery=N a benchmark makes extra
+// passes after its trials in which every Nth access is bracketed by a pair
+// of timer stamps; the stamps serialize the pipeline, so what they measure is
+// the latency of that one access rather than its share of overlapped misses.
+// Samples go into a log-linear histogram of picoseconds: values below
+// LATENCY_SUB_BUCKETS are exact, and every octave above is split into
+// LATENCY_SUB_BUCKETS equal buckets, about 6% wide. Passes repeat until
+// LATENCY_MIN_SAMPLES samples are taken, up to LATENCY_MAX_PASSES. The
+// overhead is the sampled passes' nsPerAccess over the fastest trial's.
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1u << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * (64u - LATENCY_SUB_BUCKET_BITS + 1u))
+#define LATENCY_MIN_SAMPLES 10000ull
+#define LATENCY_MAX_PASSES 1000ull
+
+typedef struct
+{
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t samples;
+    uint64_t maxPs;
+} LatencyHistogramT;
+
+typedef struct
+{
+    uint64_t every; // 0 when sampling is off
+    uint64_t samples;
+    double modeNs; // Centre of the most populated bucket
+    double p10Ns;
+    double p50Ns;
+    double p90Ns;
+    double p99Ns;
+    double p999Ns;
+    double maxNs;
+    double overheadPercent;
+} LatencySummaryT;
+
+static inline uint32_t latencyBucket(const uint64_t ps)
+{
+    if (ps < LATENCY_SUB_BUCKETS)
+    {
+        return (uint32_t)ps;
+    }
+    const uint32_t msb = 63u - (uint32_t)__builtin_clzll(ps);
+    const uint32_t octave = msb - LATENCY_SUB_BUCKET_BITS + 1u;
+    const uint32_t sub = (uint32_t)(ps >> (msb - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1u);
+    return octave * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Smallest value that falls in bucket.
+static inline double latencyBucketLowPs(const uint32_t bucket)
+{
+    const uint32_t octave = bucket / LATENCY_SUB_BUCKETS;
+    const uint32_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return octave == 0u ? (double)sub : ldexp((double)(LATENCY_SUB_BUCKETS + sub), (int)octave - 1);
+}
+
+static inline double latencyBucketCentreNs(const uint32_t bucket)
+{
+    const double low = latencyBucketLowPs(bucket);
+    const double width = bucket < LATENCY_SUB_BUCKETS ? 1.0 : latencyBucketLowPs(bucket + 1u) - low;
+    return (low + width / 2.0) * 1e-3;
+}
+
+static inline void latencyHistogramReset(LatencyHistogramT *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+// Records the access timed by start and end; tdiff has already taken off
+// the cost of the stamps themselves.
+static inline void latencyHistogramAdd(LatencyHistogramT *histogram, const fasttime_t start, const fasttime_t end)
+{
+    const uint64_t ps = (uint64_t)(tdiff(start, end) * 1e12);
+    histogram->counts[latencyBucket(ps)]++;
+    histogram->samples++;
+    histogram->maxPs = ps > histogram->maxPs ? ps : histogram->maxPs;
+}
+
+// Passes needed for LATENCY_MIN_SAMPLES samples at one every every accesses.
+static inline uint64_t latencyGetPasses(const uint64_t accessesPerPass, const uint64_t every)
+{
+    const uint64_t perPass = accessesPerPass / every > 0ull ? accessesPerPass / every : 1ull;
+    const uint64_t passes = (LATENCY_MIN_SAMPLES + perPass - 1ull) / perPass;
+    return passes < LATENCY_MAX_PASSES ? passes : LATENCY_MAX_PASSES;
+}
+
+static inline double latencyPercentileNs(const LatencyHistogramT *histogram, const double percentile)
+{
+    const uint64_t rank = (uint64_t)ceil(percentile / 100.0 * (double)histogram->samples);
+    uint64_t seen = 0ull;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+        if (seen >= rank && seen > 0ull)
+        {
+            return latencyBucketCentreNs(i);
+        }
+    }
+    return NAN;
+}
+
+static inline LatencySummaryT latencyNone(void)
+{
+    const LatencySummaryT summary = {0ull, 0ull, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN};
+    return summary;
+}
+
+// sampledNsPerAccess covers every access of the sampled passes, timed or not.
+static inline LatencySummaryT latencySummarize(const LatencyHistogramT *histogram, const uint64_t every,
+                                               const double sampledNsPerAccess, const double nsPerAccess)
+{
+    LatencySummaryT summary = latencyNone();
+    summary.every = every;
+    summary.samples = histogram->samples;
+    if (histogram->samples == 0ull)
+    {
+        return summary;
+    }
+    uint32_t mode = 0u;
+    for (uint32_t i = 1; i < LATENCY_BUCKETS; i++)
+    {
+        mode = histogram->counts[i] > histogram->counts[mode] ? i : mode;
+    }
+    summary.modeNs = latencyBucketCentreNs(mode);
+    summary.p10Ns = latencyPercentileNs(histogram, 10.0);
+    summary.p50Ns = latencyPercentileNs(histogram, 50.0);
+    summary.p90Ns = latencyPercentileNs(histogram, 90.0);
+    summary.p99Ns = latencyPercentileNs(histogram, 99.0);
+    summary.p999Ns = latencyPercentileNs(histogram, 99.9);
+    summary.maxNs = (double)histogram->maxPs * 1e-3;
+    summary.overheadPercent = (sampledNsPerAccess / nsPerAccess - 1.0) * 100.0;
+    return summary;
+}
+
+static inline const char *latencyGetHeader(void)
+{
+    return "latencyEvery,latencySamples,latencyModeNs,latencyP10Ns,latencyP50Ns,latencyP90Ns,latencyP99Ns,latencyP999Ns,latencyMaxNs,latencyOverheadPct";
+}
+
+static inline void latencyToString(const LatencySummaryT summary, char *buffer, const size_t size)
+{
+    snprintf(buffer, size, "%" PRIu64 ",%" PRIu64 ",%f,%f,%f,%f,%f,%f,%f,%f", summary.every, summary.samples, summary.modeNs,
+             summary.p10Ns, summary.p50Ns, summary.p90Ns, summary.p99Ns, summary.p999Ns, summary.maxNs, summary.overheadPercent);
+}
@@ -5,11 +5,26 @@
 #include <stdarg.h>
 #include "fasttime.h"
 #include "common.h"
+#include "prng.h"
+#include "autotune.h"
+#include "pages.h"
+#include "dataset_cache.h"
+#include "snapshot.h"
 #include <assert.h>
 #include <math.h>
 #include <float.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #define MAX_NEIGHBORS 15
+#define MAX_THREADS 64
+#define DEFAULT_QUEUE_LOG 16
+#define DEFAULT_WINDOW 64
+#define CACHE_LINE_BYTES 64
+#define ALWAYS_INLINE inline __attribute__((always_inline))
 
 typedef struct
 {
@@ -17,108 +32,1371 @@ typedef struct
     uint32_t neighbors[MAX_NEIGHBORS];
 } NodeT;
 
+// AoS keeps the mark counter in the node's cache line. SoA moves the counters
+// into their own dense array and bitmap keeps a single mark bit per node; both
+// store the neighbor lists packed at numNeighbors per node. CSR keeps SoA's
+// counters but indexes the neighbor lists through an offsets array, so that
+// every node can have its own degree.
+typedef enum
+{
+    LAYOUT_AOS,
+    LAYOUT_SOA,
+    LAYOUT_BITMAP,
+    LAYOUT_CSR,
+    NUM_LAYOUTS
+} LayoutT;
+
+static const char *const layoutNames[NUM_LAYOUTS] = {"aos", "soa", "bitmap", "csr"};
+
+// Uniform draws every edge target from all nodes. Powerlaw copies the target
+// of a random earlier edge half of the time (preferential attachment), which
+// gives a power-law fan-in. Locality draws targets within window nodes of
+// the source, as allocation order would. Tree links each node to
+// numNeighbors - 1 children and fills the remaining slot with a back edge.
+// Every generator gives each node exactly numNeighbors out-edges, so that all
+// layouts mark the same graph; variable out-degree only comes from graph=
+// snapshots, which CSR marks as they are.
+typedef enum
+{
+    GENERATOR_UNIFORM,
+    GENERATOR_POWERLAW,
+    GENERATOR_LOCALITY,
+    GENERATOR_TREE,
+    NUM_GENERATORS
+} GeneratorT;
+
+static const char *const generatorNames[NUM_GENERATORS] = {"uniform", "powerlaw", "locality", "tree"};
+
+// Relabels the nodes before timing: BFS numbers them in marking order, RCM
+// (reverse Cuthill-McKee) minimizes the bandwidth of the undirected graph.
+typedef enum
+{
+    REORDER_NONE,
+    REORDER_BFS,
+    REORDER_RCM,
+    NUM_REORDERS
+} ReorderT;
+
+static const char *const reorderNames[NUM_REORDERS] = {"none", "bfs", "rcm"};
+
+typedef struct
+{
+    NodeT *nodes;
+    uint32_t *numLivePredecessors;
+    uint64_t *markBits;
+    uint32_t *neighbors;
+    uint64_t *offsets;
+    uint32_t *newId; // Maps generated ids to reordered ids, NULL if not reordered
+    void *mapping;   // Snapshot that offsets and neighbors point into, if any
+    size_t mappingBytes;
+} GraphT;
+
 typedef struct
 {
     uint32_t numNodes;
-    uint32_t numNeighbors;
+    uint32_t numNeighbors; // Rounded-up mean degree for snapshots
+    uint64_t numEdges;
     uint32_t numRoots;
     uint32_t trials;
+    TrialPolicyT policy;
     uint32_t prefetchDistance;
+    uint32_t prefetchDistance2;
+    uint32_t threads;
+    LayoutT layout;
+    uint32_t queueLog;
+    GeneratorT generator;
+    uint32_t window;
+    ReorderT reorder;
+    uint64_t seed;
+    uint32_t initThreads;
+    char *graphPath; // Snapshot to mark instead of a generated graph
+    char *dumpPath;  // Where to save the graph as a snapshot
+    char *snapshotDir; // Where generated graphs are mapped from or saved to, if set
+    int counters;
+    PageModeT pages;
+    int populate;
 } ConfigT;
 
 char *getConfigHeader()
 {
-    return createFormattedString("HW10,totalKB,numNodes,numNeighbors,numRoots,trials,prefetchDistance");
+    return createFormattedString("HW10,totalKB,numNodes,numNeighbors,numRoots,trials,ciPercent,budgetMs,prefetchDistance,prefetchDistance2,threads,layout,queueLog,generator,window,reorder,seed,graph,pages,populate");
 }
 
 char *configToString(ConfigT config)
 {
-    return createFormattedString("HW10,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
-                                 config.numNodes / 16, config.numNodes, config.numNeighbors, config.numRoots, config.trials, config.prefetchDistance);
+    return createFormattedString("HW10,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,%f,%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%s,%" PRIu32 ",%s,%" PRIu32 ",%s,%" PRIu64 ",%s,%s,%d",
+                                 config.numNodes / 16, config.numNodes, config.numNeighbors, config.numRoots, config.trials,
+                                 config.policy.ciPercent, config.policy.budgetMs, config.prefetchDistance, config.prefetchDistance2, config.threads,
+                                 layoutNames[config.layout], config.queueLog, generatorNames[config.generator], config.window,
+                                 reorderNames[config.reorder], config.seed, config.graphPath ? config.graphPath : "generated",
+                                 pageModeNames[config.pages], config.populate);
 }
 
-static inline uint32_t getUniformSample(const uint32_t numNodes)
+// prng streams drawn by the mark benchmark.
+enum
+{
+    STREAM_TARGET,
+    STREAM_COPY_COIN,
+    STREAM_COPY_SOURCE,
+    STREAM_ROOTS
+};
+
+typedef struct
 {
-    const double uniformSample = (((double)rand()) / ((double)RAND_MAX)) * (double)numNodes;
-    return MIN(numNodes - 1, (uint32_t)uniformSample);
+    ConfigT config;
+    uint32_t *edges;
+} EdgeGeneratorT;
+
+// Preferential attachment without a sequential dependency: an edge copies a
+// random earlier edge on heads, and that edge's target is recomputed the
+// same way, so any edge can be drawn on its own.
+static inline uint32_t getPowerLawTarget(const ConfigT config, uint64_t edge)
+{
+    const uint64_t coinKey = prngKey(config.seed, STREAM_COPY_COIN);
+    const uint64_t sourceKey = prngKey(config.seed, STREAM_COPY_SOURCE);
+    while (edge > 0ull && (prngAt(coinKey, edge) & 1ull))
+    {
+        edge = prngBelow(prngAt(sourceKey, edge), edge);
+    }
+    return prngBelow(prngAt(prngKey(config.seed, STREAM_TARGET), edge), config.numNodes);
 }
 
-static inline NodeT *init(const ConfigT config)
+static void generateEdgeRange(void *context, uint64_t begin, uint64_t end)
 {
-    NodeT *data = malloc(sizeof(NodeT) * config.numNodes);
+    const EdgeGeneratorT *generator = context;
+    const ConfigT config = generator->config;
+    const uint32_t numNodes = config.numNodes;
+    const uint32_t numNeighbors = config.numNeighbors;
+    const uint32_t numChildren = MAX(numNeighbors - 1u, 1u);
+    const uint64_t targetKey = prngKey(config.seed, STREAM_TARGET);
+    uint32_t *edges = generator->edges;
 
-    for (uint32_t i = 0ull; i < config.numNodes; i++)
+    for (uint64_t i = begin; i < end; i++)
     {
-        for (uint32_t j = 0ull; j < config.numNeighbors; j++)
+        for (uint32_t j = 0ull; j < numNeighbors; j++)
         {
-            data[i].neighbors[j] = getUniformSample(config.numNodes);
+            const uint64_t edge = i * numNeighbors + j;
+            const uint64_t draw = prngAt(targetKey, edge);
+            switch (config.generator)
+            {
+            case GENERATOR_UNIFORM:
+                edges[edge] = prngBelow(draw, numNodes);
+                break;
+            case GENERATOR_POWERLAW:
+                edges[edge] = getPowerLawTarget(config, edge);
+                break;
+            case GENERATOR_LOCALITY:
+            {
+                const int64_t offset = (int64_t)prngBelow(draw, 2ull * config.window + 1ull) - config.window;
+                edges[edge] = (((int64_t)i + offset) % numNodes + numNodes) % numNodes;
+                break;
+            }
+            default:
+            {
+                const uint64_t child = i * numChildren + j + 1ull;
+                edges[edge] = (j < numChildren && child < numNodes) ? child : prngBelow(draw, i + 1ull);
+                break;
+            }
+            }
         }
     }
-    return data;
 }
 
-static inline ResultT testPrefetchDistance(const ConfigT config)
+// Setup-time adjacency in CSR form: node i's edges are
+// edges[offsets[i]..offsets[i + 1]). Generated graphs have a fixed degree of
+// numNeighbors; snapshots may have any degree.
+typedef struct
 {
-    NodeT *data = init(config);
-    uint32_t *queue = malloc(sizeof(uint32_t) * config.numNodes * MAX_NEIGHBORS);
-    double nsPerAccess = DBL_MAX;
-    uint32_t loopSum = 0ull;
+    uint32_t numNodes;
+    uint64_t numEdges;
+    uint64_t *offsets;
+    uint32_t *edges;
+} AdjacencyT;
 
-    for (uint32_t trial = 0ull; trial < config.trials; trial++)
+// Every edge is drawn from its own counter, so the graph depends only on the
+// seed.
+static inline AdjacencyT generateAdjacency(const ConfigT config)
+{
+    const uint64_t numEdges = (uint64_t)config.numNodes * config.numNeighbors;
+    EdgeGeneratorT generator = {config, malloc(sizeof(uint32_t) * numEdges)};
+    parallelFor(config.numNodes, config.initThreads, generateEdgeRange, &generator);
+    uint64_t *offsets = malloc(sizeof(uint64_t) * (config.numNodes + 1ull));
+    for (uint64_t i = 0ull; i <= config.numNodes; i++)
     {
-        uint32_t head = 0ull;
-        uint32_t tail = 0ull;
-        loopSum = 0ull;
+        offsets[i] = i * config.numNeighbors;
+    }
+    return (AdjacencyT){config.numNodes, numEdges, offsets, generator.edges};
+}
+
+// Heap snapshot file: a GraphFileHeaderT followed by the CSR offsets
+// (numNodes + 1 uint64_t) and edges (numEdges uint32_t), laid out so that
+// both arrays can be used straight from an mmap.
+#define GRAPH_FILE_MAGIC "HW10CSR"
+#define GRAPH_FILE_VERSION 1u
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numNodes;
+    uint64_t numEdges;
+} GraphFileHeaderT;
+
+static inline uint64_t getGraphFileBytes(const GraphFileHeaderT *header)
+{
+    return sizeof(GraphFileHeaderT) + sizeof(uint64_t) * (header->numNodes + 1ull) + sizeof(uint32_t) * header->numEdges;
+}
+
+// Also checks that the file is exactly as long as the header says.
+static inline int readGraphHeader(const char *path, GraphFileHeaderT *header)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return 0;
+    }
+    const int valid = fread(header, sizeof(GraphFileHeaderT), 1, fp) == 1 &&
+                      memcmp(header->magic, GRAPH_FILE_MAGIC, sizeof(GRAPH_FILE_MAGIC)) == 0 &&
+                      header->version == GRAPH_FILE_VERSION && header->numNodes > 0u &&
+                      header->numEdges < (1ull << 60) && // Keeps the expected size from overflowing
+                      fseeko(fp, 0, SEEK_END) == 0 && (uint64_t)ftello(fp) == getGraphFileBytes(header);
+    fclose(fp);
+    return valid;
+}
+
+static inline void writeGraph(const char *path, const AdjacencyT *adjacency)
+{
+    GraphFileHeaderT header = {GRAPH_FILE_MAGIC, GRAPH_FILE_VERSION, adjacency->numNodes, adjacency->numEdges};
+    FILE *fp = fopen(path, "wb");
+    assert(fp); // Could not create the snapshot file
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(adjacency->offsets, sizeof(uint64_t), adjacency->numNodes + 1ull, fp);
+    fwrite(adjacency->edges, sizeof(uint32_t), adjacency->numEdges, fp);
+    fclose(fp);
+}
+
+// Maps a snapshot read-only; the returned arrays point into the mapping.
+static inline AdjacencyT mapGraph(const char *path, void **mapping, size_t *mappingBytes)
+{
+    GraphFileHeaderT header;
+    const int valid = readGraphHeader(path, &header);
+    assert(valid); // Not a graph snapshot
+    (void)valid;
+    *mappingBytes = getGraphFileBytes(&header);
+    const int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    *mapping = mmap(NULL, *mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(*mapping != MAP_FAILED);
+    close(fd);
+    uint64_t *offsets = (uint64_t *)((char *)*mapping + sizeof(GraphFileHeaderT));
+    return (AdjacencyT){header.numNodes, header.numEdges, offsets, (uint32_t *)(offsets + header.numNodes + 1ull)};
+}
+
+// Whether the offsets run from 0 to numEdges without going back and every
+// edge targets one of the nodes, so a snapshot can be walked without bounds
+// checks.
+static inline int isValidAdjacency(const AdjacencyT *adjacency)
+{
+    if (adjacency->offsets[0] != 0ull || adjacency->offsets[adjacency->numNodes] != adjacency->numEdges)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0u; i < adjacency->numNodes; i++)
+    {
+        if (adjacency->offsets[i + 1u] < adjacency->offsets[i])
+        {
+            return 0;
+        }
+    }
+    for (uint64_t e = 0ull; e < adjacency->numEdges; e++)
+    {
+        if (adjacency->edges[e] >= adjacency->numNodes)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Maps a snapshot whose header is valid just to check its arrays, before
+// it is marked.
+static inline int isValidGraphFile(const char *path)
+{
+    void *mapping;
+    size_t mappingBytes;
+    const AdjacencyT adjacency = mapGraph(path, &mapping, &mappingBytes);
+    const int valid = isValidAdjacency(&adjacency);
+    munmap(mapping, mappingBytes);
+    return valid;
+}
+
+// Breadth-first order over the directed graph, restarting from the lowest
+// unvisited id. The order array doubles as the BFS queue.
+static inline uint32_t *getBfsOrder(const AdjacencyT *adjacency)
+{
+    const uint32_t numNodes = adjacency->numNodes;
+    uint32_t *order = malloc(sizeof(uint32_t) * numNodes);
+    uint8_t *visited = calloc(numNodes, sizeof(uint8_t));
+    uint32_t length = 0u;
+    uint32_t scan = 0u;
+    for (uint32_t start = 0u; start < numNodes; start++)
+    {
+        if (visited[start])
+        {
+            continue;
+        }
+        visited[start] = 1u;
+        order[length++] = start;
+        while (scan < length)
+        {
+            const uint32_t node = order[scan++];
+            for (uint64_t e = adjacency->offsets[node]; e < adjacency->offsets[node + 1u]; e++)
+            {
+                const uint32_t neighbor = adjacency->edges[e];
+                if (!visited[neighbor])
+                {
+                    visited[neighbor] = 1u;
+                    order[length++] = neighbor;
+                }
+            }
+        }
+    }
+    free(visited);
+    return order;
+}
+
+static int compareUint64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Reverse Cuthill-McKee over the undirected graph: BFS from a minimum-degree
+// node of each component, visiting neighbors by increasing degree, reversed.
+static inline uint32_t *getRcmOrder(const AdjacencyT *adjacency)
+{
+    const uint32_t numNodes = adjacency->numNodes;
+
+    uint64_t *offsets = calloc(numNodes + 1ull, sizeof(uint64_t));
+    for (uint32_t i = 0u; i < numNodes; i++)
+    {
+        offsets[i + 1u] += adjacency->offsets[i + 1u] - adjacency->offsets[i];
+        for (uint64_t e = adjacency->offsets[i]; e < adjacency->offsets[i + 1u]; e++)
+        {
+            offsets[adjacency->edges[e] + 1ull]++;
+        }
+    }
+    uint32_t maxDegree = 0u;
+    for (uint32_t i = 0u; i < numNodes; i++)
+    {
+        maxDegree = MAX(maxDegree, (uint32_t)offsets[i + 1u]);
+        offsets[i + 1u] += offsets[i];
+    }
+    uint32_t *undirected = malloc(sizeof(uint32_t) * 2ull * adjacency->numEdges);
+    uint64_t *fill = malloc(sizeof(uint64_t) * numNodes);
+    memcpy(fill, offsets, sizeof(uint64_t) * numNodes);
+    for (uint32_t i = 0u; i < numNodes; i++)
+    {
+        for (uint64_t e = adjacency->offsets[i]; e < adjacency->offsets[i + 1u]; e++)
+        {
+            undirected[fill[i]++] = adjacency->edges[e];
+            undirected[fill[adjacency->edges[e]]++] = i;
+        }
+    }
+
+    // Counting sort by degree picks each component's start node in O(1).
+    uint32_t *byDegree = malloc(sizeof(uint32_t) * numNodes);
+    uint64_t *degreeStart = calloc(maxDegree + 2ull, sizeof(uint64_t));
+    for (uint32_t i = 0u; i < numNodes; i++)
+    {
+        degreeStart[offsets[i + 1u] - offsets[i] + 1ull]++;
+    }
+    for (uint32_t d = 0u; d <= maxDegree; d++)
+    {
+        degreeStart[d + 1u] += degreeStart[d];
+    }
+    for (uint32_t i = 0u; i < numNodes; i++)
+    {
+        byDegree[degreeStart[offsets[i + 1u] - offsets[i]]++] = i;
+    }
+
+    uint32_t *order = malloc(sizeof(uint32_t) * numNodes);
+    uint8_t *visited = calloc(numNodes, sizeof(uint8_t));
+    uint64_t *candidates = malloc(sizeof(uint64_t) * MAX(maxDegree, 1u));
+    uint32_t length = 0u;
+    uint32_t scan = 0u;
+    for (uint32_t k = 0u; k < numNodes; k++)
+    {
+        if (visited[byDegree[k]])
+        {
+            continue;
+        }
+        visited[byDegree[k]] = 1u;
+        order[length++] = byDegree[k];
+        while (scan < length)
+        {
+            const uint32_t node = order[scan++];
+            uint32_t numCandidates = 0u;
+            for (uint64_t a = offsets[node]; a < offsets[node + 1u]; a++)
+            {
+                const uint32_t neighbor = undirected[a];
+                if (!visited[neighbor])
+                {
+                    visited[neighbor] = 1u;
+                    candidates[numCandidates++] = ((offsets[neighbor + 1u] - offsets[neighbor]) << 32) | neighbor;
+                }
+            }
+            qsort(candidates, numCandidates, sizeof(uint64_t), compareUint64);
+            for (uint32_t c = 0u; c < numCandidates; c++)
+            {
+                order[length++] = (uint32_t)candidates[c];
+            }
+        }
+    }
+    for (uint32_t i = 0u; i < numNodes / 2u; i++)
+    {
+        const uint32_t swap = order[i];
+        order[i] = order[numNodes - 1u - i];
+        order[numNodes - 1u - i] = swap;
+    }
+
+    free(candidates);
+    free(visited);
+    free(degreeStart);
+    free(byDegree);
+    free(fill);
+    free(undirected);
+    free(offsets);
+    return order;
+}
+
+// Returns adjacency relabeled so that order[k] becomes node k, and the map
+// from old ids to new ones in newId.
+static inline AdjacencyT applyOrder(const AdjacencyT *adjacency, const uint32_t *order, uint32_t **newId)
+{
+    const uint32_t numNodes = adjacency->numNodes;
+    *newId = malloc(sizeof(uint32_t) * numNodes);
+    for (uint32_t k = 0u; k < numNodes; k++)
+    {
+        (*newId)[order[k]] = k;
+    }
+    AdjacencyT reordered = {numNodes, adjacency->numEdges, malloc(sizeof(uint64_t) * (numNodes + 1ull)),
+                            malloc(sizeof(uint32_t) * adjacency->numEdges)};
+    reordered.offsets[0] = 0ull;
+    for (uint32_t k = 0u; k < numNodes; k++)
+    {
+        uint64_t fill = reordered.offsets[k];
+        for (uint64_t e = adjacency->offsets[order[k]]; e < adjacency->offsets[order[k] + 1u]; e++)
+        {
+            reordered.edges[fill++] = (*newId)[adjacency->edges[e]];
+        }
+        reordered.offsets[k + 1u] = fill;
+    }
+    return reordered;
+}
+
+// Releases setup-time adjacency, which is either malloc'd or a snapshot
+// mapping owned by graph.
+static inline void freeAdjacency(GraphT *graph, AdjacencyT *adjacency)
+{
+    if (graph->mapping)
+    {
+        munmap(graph->mapping, graph->mappingBytes);
+        graph->mapping = NULL;
+    }
+    else
+    {
+        pagesFree(adjacency->offsets);
+        pagesFree(adjacency->edges);
+    }
+}
+
+static inline void *copyToPages(const void *source, const size_t bytes, const ConfigT config)
+{
+    void *copy = pagesAlloc(bytes, config.pages, config.populate);
+    memcpy(copy, source, bytes);
+    return copy;
+}
 
+// Only the locality generator reads window, so the dataset keys leave it out
+// for the others and their identical graphs are shared.
+static inline uint32_t getKeyWindow(const ConfigT config)
+{
+    return config.generator == GENERATOR_LOCALITY ? config.window : 0u;
+}
+
+// With a snapshot directory, the generated adjacency (before any reordering,
+// which needs the generated ids) is mapped from its snapshot when one exists
+// and saved to one otherwise. A mapped adjacency is owned by graph, like a
+// graph= snapshot.
+static inline AdjacencyT loadAdjacency(const ConfigT config, GraphT *graph)
+{
+    if (!config.snapshotDir)
+    {
+        return generateAdjacency(config);
+    }
+    const DatasetKeyT key = {{config.numNodes, config.numNeighbors, config.generator, getKeyWindow(config), config.seed}};
+    char *path = snapshotPath(config.snapshotDir, "mark", &key);
+    const SnapshotT snapshot = snapshotMap(path, &key, config.populate);
+    AdjacencyT adjacency;
+    if (snapshot.mapping)
+    {
+        graph->mapping = snapshot.mapping;
+        graph->mappingBytes = snapshot.mappingBytes;
+        adjacency = (AdjacencyT){config.numNodes, config.numEdges, snapshot.sections[0], snapshot.sections[1]};
+    }
+    else
+    {
+        adjacency = generateAdjacency(config);
+        const void *sections[] = {adjacency.offsets, adjacency.edges};
+        const uint64_t sectionBytes[] = {sizeof(uint64_t) * (adjacency.numNodes + 1ull), sizeof(uint32_t) * adjacency.numEdges};
+        snapshotWrite(path, &key, 2u, sections, sectionBytes);
+    }
+    free(path);
+    return adjacency;
+}
+
+static inline GraphT init(const ConfigT config)
+{
+    GraphT graph = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0};
+    AdjacencyT adjacency = config.graphPath ? mapGraph(config.graphPath, &graph.mapping, &graph.mappingBytes) : loadAdjacency(config, &graph);
+    if (config.reorder != REORDER_NONE)
+    {
+        uint32_t *order = config.reorder == REORDER_BFS ? getBfsOrder(&adjacency) : getRcmOrder(&adjacency);
+        const AdjacencyT reordered = applyOrder(&adjacency, order, &graph.newId);
+        free(order);
+        freeAdjacency(&graph, &adjacency);
+        adjacency = reordered;
+    }
+    if (config.dumpPath)
+    {
+        writeGraph(config.dumpPath, &adjacency);
+    }
+    if (config.pages != PAGES_MALLOC && config.layout != LAYOUT_AOS)
+    {
+        // The layouts that keep the adjacency move it onto the requested
+        // pages, copying a snapshot out of its file mapping.
+        AdjacencyT backed = {adjacency.numNodes, adjacency.numEdges,
+                             copyToPages(adjacency.offsets, sizeof(uint64_t) * (adjacency.numNodes + 1ull), config),
+                             copyToPages(adjacency.edges, sizeof(uint32_t) * adjacency.numEdges, config)};
+        freeAdjacency(&graph, &adjacency);
+        adjacency = backed;
+    }
+
+    // Only CSR can hold a snapshot's variable degrees, so the fixed-degree
+    // layouts only ever see generated graphs.
+    switch (config.layout)
+    {
+    case LAYOUT_AOS:
+        graph.nodes = pagesAlloc(sizeof(NodeT) * config.numNodes, config.pages, config.populate);
+        for (uint32_t i = 0ull; i < config.numNodes; i++)
+        {
+            memcpy(graph.nodes[i].neighbors, &adjacency.edges[adjacency.offsets[i]], sizeof(uint32_t) * config.numNeighbors);
+        }
+        freeAdjacency(&graph, &adjacency);
+        break;
+    case LAYOUT_SOA:
+        graph.numLivePredecessors = pagesAlloc(sizeof(uint32_t) * config.numNodes, config.pages, config.populate);
+        graph.neighbors = adjacency.edges;
+        if (!graph.mapping)
+        {
+            pagesFree(adjacency.offsets); // A mapped snapshot is released whole by freeGraph
+        }
+        break;
+    case LAYOUT_CSR:
+        graph.numLivePredecessors = pagesAlloc(sizeof(uint32_t) * config.numNodes, config.pages, config.populate);
+        graph.offsets = adjacency.offsets;
+        graph.neighbors = adjacency.edges;
+        break;
+    default:
+        graph.markBits = pagesAlloc(sizeof(uint64_t) * ((config.numNodes + 63ull) / 64ull), config.pages, config.populate);
+        graph.neighbors = adjacency.edges;
+        if (!graph.mapping)
+        {
+            pagesFree(adjacency.offsets); // A mapped snapshot is released whole by freeGraph
+        }
+        break;
+    }
+    return graph;
+}
+
+// Roots are drawn per (trial, root) in generated ids, so that every thread
+// count and every reorder marks the same logical graph.
+static inline uint32_t sampleRoot(const GraphT *graph, const ConfigT config, const uint32_t trial, const uint32_t i)
+{
+    const uint64_t draw = prngAt(prngKey(config.seed, STREAM_ROOTS), (uint64_t)trial * config.numRoots + i);
+    const uint32_t root = prngBelow(draw, config.numNodes);
+    return graph->newId ? graph->newId[root] : root;
+}
+
+static inline uint64_t graphBytes(const ConfigT config)
+{
+    const uint64_t neighborBytes = sizeof(uint32_t) * config.numEdges;
+    switch (config.layout)
+    {
+    case LAYOUT_AOS:
+        return sizeof(NodeT) * config.numNodes;
+    case LAYOUT_SOA:
+        return sizeof(uint32_t) * config.numNodes + neighborBytes;
+    case LAYOUT_CSR:
+        return sizeof(uint32_t) * config.numNodes + sizeof(uint64_t) * (config.numNodes + 1ull) + neighborBytes;
+    default:
+        return sizeof(uint64_t) * ((config.numNodes + 63ull) / 64ull) + neighborBytes;
+    }
+}
+
+static inline void freeGraph(GraphT *graph)
+{
+    if (graph->mapping)
+    {
+        munmap(graph->mapping, graph->mappingBytes);
+    }
+    else
+    {
+        pagesFree(graph->offsets);
+        pagesFree(graph->neighbors);
+    }
+    pagesFree(graph->nodes);
+    pagesFree(graph->numLivePredecessors);
+    pagesFree(graph->markBits);
+    free(graph->newId);
+}
+
+static inline void resetMarks(GraphT *graph, const ConfigT config)
+{
+    switch (config.layout)
+    {
+    case LAYOUT_AOS:
         for (uint32_t i = 0; i < config.numNodes; i++)
         {
-            data[i].numLivePredecessors = 0ul;
+            graph->nodes[i].numLivePredecessors = 0ul;
         }
+        break;
+    case LAYOUT_SOA:
+    case LAYOUT_CSR:
+        memset(graph->numLivePredecessors, 0, sizeof(uint32_t) * config.numNodes);
+        break;
+    default:
+        memset(graph->markBits, 0, sizeof(uint64_t) * ((config.numNodes + 63ull) / 64ull));
+        break;
+    }
+}
 
-        const fasttime_t t1 = gettime();
+static ALWAYS_INLINE const uint32_t *getNeighbors(const GraphT *graph, const uint32_t numNeighbors, const uint32_t index, const LayoutT layout)
+{
+    switch (layout)
+    {
+    case LAYOUT_AOS:
+        return graph->nodes[index].neighbors;
+    case LAYOUT_CSR:
+        return &graph->neighbors[graph->offsets[index]];
+    default:
+        return &graph->neighbors[(uint64_t)index * numNeighbors];
+    }
+}
+
+static ALWAYS_INLINE uint32_t getDegree(const GraphT *graph, const uint32_t numNeighbors, const uint32_t index, const LayoutT layout)
+{
+    if (layout == LAYOUT_CSR)
+    {
+        return graph->offsets[index + 1u] - graph->offsets[index];
+    }
+    return numNeighbors;
+}
+
+// Records a visit to index and returns whether it was the first one.
+static ALWAYS_INLINE int visitNode(GraphT *graph, const uint32_t index, const LayoutT layout)
+{
+    switch (layout)
+    {
+    case LAYOUT_AOS:
+        return graph->nodes[index].numLivePredecessors++ == 0u;
+    case LAYOUT_SOA:
+    case LAYOUT_CSR:
+        return graph->numLivePredecessors[index]++ == 0u;
+    default:
+    {
+        const uint64_t bit = 1ull << (index & 63u);
+        uint64_t *word = &graph->markBits[index >> 6];
+        const int firstVisit = !(*word & bit);
+        *word |= bit;
+        return firstVisit;
+    }
+    }
+}
+
+static ALWAYS_INLINE int isMarked(const GraphT *graph, const uint32_t index, const LayoutT layout)
+{
+    switch (layout)
+    {
+    case LAYOUT_AOS:
+        return __atomic_load_n(&graph->nodes[index].numLivePredecessors, __ATOMIC_RELAXED) != 0u;
+    case LAYOUT_SOA:
+    case LAYOUT_CSR:
+        return __atomic_load_n(&graph->numLivePredecessors[index], __ATOMIC_RELAXED) != 0u;
+    default:
+        return (__atomic_load_n(&graph->markBits[index >> 6], __ATOMIC_RELAXED) >> (index & 63u)) & 1ull;
+    }
+}
+
+// First prefetch stage: start loading everything a visit to index touches.
+static ALWAYS_INLINE void prefetchNode(const GraphT *graph, const uint32_t numNeighbors, const uint32_t index, const LayoutT layout)
+{
+    switch (layout)
+    {
+    case LAYOUT_AOS:
+        __builtin_prefetch(&graph->nodes[index], 1);
+        break;
+    case LAYOUT_SOA:
+        __builtin_prefetch(&graph->numLivePredecessors[index], 1);
+        __builtin_prefetch(&graph->neighbors[(uint64_t)index * numNeighbors]);
+        break;
+    case LAYOUT_CSR:
+        // The neighbor list's address is only known once offsets arrives.
+        __builtin_prefetch(&graph->numLivePredecessors[index], 1);
+        __builtin_prefetch(&graph->offsets[index]);
+        break;
+    default:
+        __builtin_prefetch(&graph->markBits[index >> 6], 1);
+        __builtin_prefetch(&graph->neighbors[(uint64_t)index * numNeighbors]);
+        break;
+    }
+}
+
+// Second prefetch stage: by now the first stage has made index resident. If
+// it is still unmarked its visit will push its neighbors, so start loading
+// the nodes they point to.
+static ALWAYS_INLINE void prefetchNeighbors(const GraphT *graph, const uint32_t numNeighbors, const uint32_t index, const LayoutT layout)
+{
+    if (!isMarked(graph, index, layout))
+    {
+        const uint32_t *neighbors = getNeighbors(graph, numNeighbors, index, layout);
+        const uint32_t degree = getDegree(graph, numNeighbors, index, layout);
+        for (uint32_t i = 0ull; i < degree; i++)
+        {
+            prefetchNode(graph, numNeighbors, neighbors[i], layout);
+        }
+    }
+}
+
+// Thread-safe visitNode: exactly one visitor claims each node.
+static ALWAYS_INLINE int visitNodeAtomic(GraphT *graph, const uint32_t index, const LayoutT layout)
+{
+    switch (layout)
+    {
+    case LAYOUT_AOS:
+        return __atomic_fetch_add(&graph->nodes[index].numLivePredecessors, 1u, __ATOMIC_RELAXED) == 0u;
+    case LAYOUT_SOA:
+    case LAYOUT_CSR:
+        return __atomic_fetch_add(&graph->numLivePredecessors[index], 1u, __ATOMIC_RELAXED) == 0u;
+    default:
+    {
+        const uint64_t bit = 1ull << (index & 63u);
+        uint64_t *word = &graph->markBits[index >> 6];
+        if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+        {
+            return 0;
+        }
+        return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+    }
+    }
+}
+
+// Overflow path for the bounded mark queues: a growable stack that only
+// sees traffic once a ring is full.
+typedef struct
+{
+    uint32_t *items;
+    uint64_t length;
+    uint64_t capacity;
+} SpillStackT;
+
+static inline void spillPush(SpillStackT *spill, const uint32_t index)
+{
+    if (spill->length == spill->capacity)
+    {
+        spill->capacity = MAX(2ull * spill->capacity, 1024ull);
+        spill->items = realloc(spill->items, sizeof(uint32_t) * spill->capacity);
+    }
+    spill->items[spill->length++] = index;
+}
+
+// Chase-Lev work-stealing deque: the owner pushes and pops at bottom, thieves
+// steal from top. top and bottom only grow, so buffer is used as a ring.
+typedef struct
+{
+    int64_t top;
+    char topPadding[CACHE_LINE_BYTES - sizeof(int64_t)];
+    int64_t bottom;
+    char bottomPadding[CACHE_LINE_BYTES - sizeof(int64_t)];
+    uint32_t *buffer;
+    int64_t mask;
+    SpillStackT spill; // Owner only
+} __attribute__((aligned(CACHE_LINE_BYTES))) DequeT;
+
+static inline void dequeReset(DequeT *deque)
+{
+    __atomic_store_n(&deque->top, 0ll, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, 0ll, __ATOMIC_RELAXED);
+    deque->spill.length = 0ull;
+}
+
+// Returns 0 without pushing if the ring is full.
+static inline int dequePush(DequeT *deque, const uint32_t index)
+{
+    const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    const int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top > deque->mask)
+    {
+        return 0;
+    }
+    __atomic_store_n(&deque->buffer[bottom & deque->mask], index, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline void dequePushOrSpill(DequeT *deque, const uint32_t index)
+{
+    if (!dequePush(deque, index))
+    {
+        spillPush(&deque->spill, index);
+    }
+}
+
+// Moves spilled entries back into the (empty) ring. Refilling only half of
+// it leaves room for the neighbors they push.
+static inline int dequeRefill(DequeT *deque)
+{
+    const uint64_t count = MIN(deque->spill.length, (uint64_t)(deque->mask + 1) / 2ull);
+    for (uint64_t i = 0ull; i < count; i++)
+    {
+        dequePush(deque, deque->spill.items[--deque->spill.length]);
+    }
+    return count != 0ull;
+}
+
+static inline int dequePop(DequeT *deque, uint32_t *index)
+{
+    const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom)
+    {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *index = __atomic_load_n(&deque->buffer[bottom & deque->mask], __ATOMIC_RELAXED);
+    if (top < bottom)
+    {
+        return 1;
+    }
+    // Last element: race the thieves for it.
+    const int won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+static inline int dequeSteal(DequeT *deque, uint32_t *index)
+{
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom)
+    {
+        return 0;
+    }
+    *index = __atomic_load_n(&deque->buffer[top & deque->mask], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static inline int dequeIsEmpty(DequeT *deque)
+{
+    return __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+}
+
+typedef struct
+{
+    ConfigT config;
+    GraphT graph;
+    DequeT *deques;
+    pthread_barrier_t barrier;
+    uint32_t numIdle;
+    int done; // Set by the main thread once the trial policy is met
+} MarkStateT;
+
+typedef struct
+{
+    MarkStateT *state;
+    pthread_t thread;
+    uint32_t id;
+    uint64_t loopSum;
+    PerfSampleT sample; // This worker's counters for the last trial
+} __attribute__((aligned(CACHE_LINE_BYTES))) WorkerT;
+
+static ALWAYS_INLINE uint64_t markParallelLayout(MarkStateT *state, const uint32_t id, const LayoutT layout)
+{
+    const uint32_t threads = state->config.threads;
+    const uint32_t numNeighbors = state->config.numNeighbors;
+    const int64_t prefetchDistance = state->config.prefetchDistance;
+    const int64_t prefetchDistance2 = state->config.prefetchDistance2;
+    GraphT *graph = &state->graph;
+    DequeT *own = &state->deques[id];
+    uint64_t loopSum = 0ull;
+    uint32_t index;
+
+    for (;;)
+    {
+        // The owner pops LIFO, so the entry d below bottom is visited d pops
+        // from now unless a thief takes it first, which only wastes a prefetch.
+        const int64_t bottom = __atomic_load_n(&own->bottom, __ATOMIC_RELAXED);
+        const int64_t top = __atomic_load_n(&own->top, __ATOMIC_RELAXED);
+        if (prefetchDistance && bottom - 1 - prefetchDistance >= top)
+        {
+            prefetchNode(graph, numNeighbors, own->buffer[(bottom - 1 - prefetchDistance) & own->mask], layout);
+        }
+        if (prefetchDistance2 && bottom - 1 - prefetchDistance2 >= top)
+        {
+            prefetchNeighbors(graph, numNeighbors, own->buffer[(bottom - 1 - prefetchDistance2) & own->mask], layout);
+        }
+
+        int found = dequePop(own, &index);
+        for (uint32_t i = 1; !found && !own->spill.length && i < threads; i++)
+        {
+            found = dequeSteal(&state->deques[(id + i) % threads], &index);
+        }
+        if (found)
+        {
+            if (visitNodeAtomic(graph, index, layout))
+            {
+                const uint32_t *neighbors = getNeighbors(graph, numNeighbors, index, layout);
+                const uint32_t degree = getDegree(graph, numNeighbors, index, layout);
+                for (uint32_t i = 0ull; i < degree; i++)
+                {
+                    dequePushOrSpill(own, neighbors[i]);
+                }
+            }
+            loopSum++;
+            continue;
+        }
+        if (dequeRefill(own))
+        {
+            continue;
+        }
+
+        // Out of work: the trial is done once every worker is idle. An idle
+        // worker's deque stays empty, so it must leave the idle count before
+        // it may steal again.
+        __atomic_fetch_add(&state->numIdle, 1u, __ATOMIC_SEQ_CST);
+        for (;;)
+        {
+            if (__atomic_load_n(&state->numIdle, __ATOMIC_SEQ_CST) == threads)
+            {
+                return loopSum;
+            }
+            int hasWork = 0;
+            for (uint32_t i = 1; !hasWork && i < threads; i++)
+            {
+                hasWork = !dequeIsEmpty(&state->deques[(id + i) % threads]);
+            }
+            if (hasWork)
+            {
+                __atomic_fetch_sub(&state->numIdle, 1u, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static uint64_t markParallel(MarkStateT *state, const uint32_t id)
+{
+    switch (state->config.layout)
+    {
+    case LAYOUT_AOS:
+        return markParallelLayout(state, id, LAYOUT_AOS);
+    case LAYOUT_SOA:
+        return markParallelLayout(state, id, LAYOUT_SOA);
+    case LAYOUT_CSR:
+        return markParallelLayout(state, id, LAYOUT_CSR);
+    default:
+        return markParallelLayout(state, id, LAYOUT_BITMAP);
+    }
+}
+
+static void *markWorker(void *arg)
+{
+    WorkerT *worker = arg;
+    MarkStateT *state = worker->state;
+    // The number of trials is only known as they finish, so every round
+    // starts with a barrier after which the workers check whether to stop.
+    for (;;)
+    {
+        pthread_barrier_wait(&state->barrier);
+        if (__atomic_load_n(&state->done, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        perfStart(state->config.counters);
+        worker->loopSum = markParallel(state, worker->id);
+        worker->sample = perfStop(state->config.counters);
+        pthread_barrier_wait(&state->barrier);
+    }
+    if (state->config.counters)
+    {
+        perfClose();
+    }
+    return NULL;
+}
+
+static inline uint64_t nextPowerOfTwo(const uint64_t x)
+{
+    uint64_t power = 1ull;
+    while (power < x)
+    {
+        power <<= 1ull;
+    }
+    return power;
+}
+
+static inline ResultT testPrefetchDistanceParallel(const ConfigT config, GraphT *graph)
+{
+    const uint32_t threads = config.threads;
+    const uint64_t dequeLength = 1ull << config.queueLog;
+    MarkStateT state = {.config = config, .graph = *graph, .numIdle = 0u, .done = 0};
+    state.deques = aligned_alloc(CACHE_LINE_BYTES, sizeof(DequeT) * threads);
+    WorkerT *workers = aligned_alloc(CACHE_LINE_BYTES, sizeof(WorkerT) * threads);
+    pthread_barrier_init(&state.barrier, NULL, threads);
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        state.deques[i].buffer = malloc(sizeof(uint32_t) * dequeLength);
+        state.deques[i].mask = dequeLength - 1ull;
+        state.deques[i].spill = (SpillStackT){NULL, 0ull, 0ull};
+        workers[i] = (WorkerT){.state = &state, .id = i, .loopSum = 0ull, .sample = perfNone()};
+    }
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        pthread_create(&workers[i].thread, NULL, markWorker, &workers[i]);
+    }
 
+    double nsPerAccess = DBL_MAX;
+    PerfSampleT perAccess = perfNone();
+    uint64_t loopSum = 0ull;
+    TrialSamplesT samples = {{0.0}, 0u, 0.0};
+
+    for (uint32_t trial = 0ull; !trialsDone(&samples, config.policy); trial++)
+    {
+        resetMarks(&state.graph, config);
+        for (uint32_t i = 0; i < threads; i++)
+        {
+            dequeReset(&state.deques[i]);
+        }
         for (uint32_t i = 0; i < config.numRoots; i++)
         {
-            queue[head++] = getUniformSample(config.numNodes);
+            dequePushOrSpill(&state.deques[i % threads], sampleRoot(&state.graph, config, trial, i));
         }
+        state.numIdle = 0u;
+
+        // The clock starts before the barrier releases the other workers, so
+        // none of their marking can fall outside the timed region.
+        perfStart(config.counters);
+        const fasttime_t t1 = gettime();
+        pthread_barrier_wait(&state.barrier);
+        workers[0].loopSum = markParallel(&state, 0);
+        pthread_barrier_wait(&state.barrier);
+        const fasttime_t t2 = gettime();
+        PerfSampleT sample = perfStop(config.counters);
 
+        loopSum = 0ull;
+        for (uint32_t i = 0; i < threads; i++)
+        {
+            loopSum += workers[i].loopSum;
+            sample = i > 0 ? perfAdd(sample, workers[i].sample) : sample;
+        }
+        const double trialNsPerAccess = (tdiff(t1, t2) * 1e9) / ((double)loopSum);
+        trialSamplesAdd(&samples, trialNsPerAccess, tdiff(t1, t2) * 1e3);
+        if (trialNsPerAccess < nsPerAccess)
+        {
+            nsPerAccess = trialNsPerAccess;
+            perAccess = perfPerAccess(sample, (double)loopSum);
+        }
+    }
+
+    __atomic_store_n(&state.done, 1, __ATOMIC_RELEASE);
+    pthread_barrier_wait(&state.barrier);
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    uint64_t peakBytes = graphBytes(config);
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        peakBytes += sizeof(uint32_t) * (dequeLength + state.deques[i].spill.capacity);
+        free(state.deques[i].buffer);
+        free(state.deques[i].spill.items);
+    }
+    pthread_barrier_destroy(&state.barrier);
+    free(workers);
+    free(state.deques);
+    return (ResultT){loopSum, nsPerAccess, peakBytes / 1024ull, perAccess, trialStatsCompute(&samples), latencyNone()};
+}
+
+// Serial mark queue: a power-of-two FIFO ring that spills to a stack when
+// full. head and tail only grow and are masked on access.
+typedef struct
+{
+    uint32_t *ring;
+    uint64_t mask;
+    uint64_t head;
+    uint64_t tail;
+    SpillStackT spill;
+} MarkQueueT;
+
+static inline void queuePush(MarkQueueT *queue, const uint32_t index)
+{
+    if (queue->head - queue->tail <= queue->mask)
+    {
+        queue->ring[queue->head++ & queue->mask] = index;
+    }
+    else
+    {
+        spillPush(&queue->spill, index);
+    }
+}
+
+// Like dequeRefill, refills only half of the empty ring.
+static inline void queueRefill(MarkQueueT *queue)
+{
+    const uint64_t count = MIN(queue->spill.length, (queue->mask + 1ull) / 2ull);
+    for (uint64_t i = 0ull; i < count; i++)
+    {
+        queuePush(queue, queue->spill.items[--queue->spill.length]);
+    }
+}
+
+static ALWAYS_INLINE uint64_t markSerialLayout(GraphT *graph, const ConfigT config, MarkQueueT *queue, const LayoutT layout)
+{
+    uint32_t *ring = queue->ring;
+    const uint64_t mask = queue->mask;
+    uint64_t loopSum = 0ull;
+    for (;;)
+    {
+        uint64_t head = queue->head;
+        uint64_t tail = queue->tail;
         while (head != tail)
         {
-            // --------------------------- //
-            // Put prefetch code here
-            // --------------------------- //
-            NodeT *node = &data[queue[tail++]];
-            if (node->numLivePredecessors == 0ull)
+            if (config.prefetchDistance && tail + config.prefetchDistance < head)
+            {
+                prefetchNode(graph, config.numNeighbors, ring[(tail + config.prefetchDistance) & mask], layout);
+            }
+            if (config.prefetchDistance2 && tail + config.prefetchDistance2 < head)
+            {
+                prefetchNeighbors(graph, config.numNeighbors, ring[(tail + config.prefetchDistance2) & mask], layout);
+            }
+            const uint32_t index = ring[tail++ & mask];
+            if (visitNode(graph, index, layout))
             {
-                for (uint32_t i = 0ull; i < config.numNeighbors; i++)
+                const uint32_t *neighbors = getNeighbors(graph, config.numNeighbors, index, layout);
+                const uint32_t degree = getDegree(graph, config.numNeighbors, index, layout);
+                if (head - tail + degree <= mask + 1ull)
                 {
-                    queue[head++] = node->neighbors[i];
+                    for (uint32_t i = 0ull; i < degree; i++)
+                    {
+                        ring[head++ & mask] = neighbors[i];
+                    }
+                }
+                else
+                {
+                    for (uint32_t i = 0ull; i < degree; i++)
+                    {
+                        if (head - tail <= mask)
+                        {
+                            ring[head++ & mask] = neighbors[i];
+                        }
+                        else
+                        {
+                            spillPush(&queue->spill, neighbors[i]);
+                        }
+                    }
                 }
             }
-            node->numLivePredecessors++;
             loopSum++;
         }
+        queue->head = head;
+        queue->tail = tail;
+        if (!queue->spill.length)
+        {
+            return loopSum;
+        }
+        queueRefill(queue);
+    }
+}
+
+static uint64_t markSerial(GraphT *graph, const ConfigT config, MarkQueueT *queue)
+{
+    switch (config.layout)
+    {
+    case LAYOUT_AOS:
+        return markSerialLayout(graph, config, queue, LAYOUT_AOS);
+    case LAYOUT_SOA:
+        return markSerialLayout(graph, config, queue, LAYOUT_SOA);
+    case LAYOUT_CSR:
+        return markSerialLayout(graph, config, queue, LAYOUT_CSR);
+    default:
+        return markSerialLayout(graph, config, queue, LAYOUT_BITMAP);
+    }
+}
+
+static inline ResultT testPrefetchDistanceSerial(const ConfigT config, GraphT *graph)
+{
+    const uint64_t queueLength = 1ull << config.queueLog;
+    MarkQueueT queue = {.ring = malloc(sizeof(uint32_t) * queueLength), .mask = queueLength - 1ull, .spill = {NULL, 0ull, 0ull}};
+    double nsPerAccess = DBL_MAX;
+    PerfSampleT perAccess = perfNone();
+    uint64_t loopSum = 0ull;
+    TrialSamplesT samples = {{0.0}, 0u, 0.0};
+
+    for (uint32_t trial = 0ull; !trialsDone(&samples, config.policy); trial++)
+    {
+        queue.head = 0ull;
+        queue.tail = 0ull;
+        queue.spill.length = 0ull;
+        resetMarks(graph, config);
+
+        // Roots are sampled outside the timed region, as in the parallel mode.
+        for (uint32_t i = 0; i < config.numRoots; i++)
+        {
+            queuePush(&queue, sampleRoot(graph, config, trial, i));
+        }
+
+        perfStart(config.counters);
+        const fasttime_t t1 = gettime();
+        loopSum = markSerial(graph, config, &queue);
         const fasttime_t t2 = gettime();
-        nsPerAccess = MIN(((tdiff(t1, t2) * 1e9) / ((double)loopSum)), nsPerAccess);
+        const PerfSampleT sample = perfStop(config.counters);
+        const double trialNsPerAccess = (tdiff(t1, t2) * 1e9) / ((double)loopSum);
+        trialSamplesAdd(&samples, trialNsPerAccess, tdiff(t1, t2) * 1e3);
+        if (trialNsPerAccess < nsPerAccess)
+        {
+            nsPerAccess = trialNsPerAccess;
+            perAccess = perfPerAccess(sample, (double)loopSum);
+        }
+    }
+
+    const uint64_t peakBytes = graphBytes(config) + sizeof(uint32_t) * (queueLength + queue.spill.capacity);
+    free(queue.ring);
+    free(queue.spill.items);
+    return (ResultT){loopSum, nsPerAccess, peakBytes / 1024ull, perAccess, trialStatsCompute(&samples), latencyNone()};
+}
+
+static inline ResultT runTrials(const ConfigT config, GraphT *graph)
+{
+    return config.threads > 1 ? testPrefetchDistanceParallel(config, graph) : testPrefetchDistanceSerial(config, graph);
+}
+
+static void destroyGraph(void *graph)
+{
+    freeGraph(graph);
+    free(graph);
+}
+
+// Every trial resets the marks first, so lines that share a graph's shape
+// share one copy. Lines that read or dump a snapshot bypass the cache and
+// release their graph when done.
+static inline GraphT *acquireGraph(const ConfigT config)
+{
+    const DatasetKeyT key = {{config.numNodes, config.numNeighbors, config.layout, config.generator, getKeyWindow(config),
+                              config.reorder, config.seed, config.pages, config.populate}};
+    const int cached = !config.graphPath && !config.dumpPath;
+    GraphT *graph = cached ? datasetCacheGet(&key) : NULL;
+    if (!graph)
+    {
+        if (cached)
+        {
+            datasetCacheReserve(graphBytes(config));
+        }
+        graph = malloc(sizeof(GraphT));
+        *graph = init(config);
+        if (cached)
+        {
+            datasetCachePut(&key, graph, graphBytes(config), destroyGraph);
+        }
+    }
+    return graph;
+}
+
+static inline void releaseGraph(const ConfigT config, GraphT *graph)
+{
+    if (config.graphPath || config.dumpPath)
+    {
+        destroyGraph(graph);
+    }
+}
+
+static inline ResultT testPrefetchDistance(const ConfigT config)
+{
+    GraphT *graph = acquireGraph(config);
+    const ResultT result = runTrials(config, graph);
+    releaseGraph(config, graph);
+    return result;
+}
+
+// --autotune keeps one graph resident per args line and searches distances
+// up to MAX_AUTOTUNE_DISTANCE queue entries instead of taking the positional
+// one; each evaluation is a full set of trials.
+#define MAX_AUTOTUNE_DISTANCE 1024ull
+
+typedef struct
+{
+    ConfigT config;
+    GraphT *graph;
+    ResultT best;
+} MarkAutotuneT;
+
+static double markCost(void *context, uint64_t distance)
+{
+    MarkAutotuneT *tune = context;
+    tune->config.prefetchDistance = (uint32_t)distance;
+    const ResultT result = runTrials(tune->config, tune->graph);
+    if (result.nsPerAccess < tune->best.nsPerAccess)
+    {
+        tune->best = result;
     }
+    return result.nsPerAccess;
+}
 
-    return (ResultT){loopSum, nsPerAccess};
+static inline ResultT autotunePrefetchDistance(ConfigT *config)
+{
+    GraphT *graph = acquireGraph(*config);
+    MarkAutotuneT tune = {.config = *config, .graph = graph, .best = {.nsPerAccess = DBL_MAX}};
+    const AutotuneT search = autotuneDistance(0ull, MIN(MAX_AUTOTUNE_DISTANCE, (uint64_t)config->numNodes), markCost, &tune);
+    config->prefetchDistance = (uint32_t)search.bestDistance;
+    releaseGraph(*config, graph);
+    return tune.best;
 }
+
 #define BOUND(x, min, max) ((x) <= (min) ? (min) : ((x) >= (max) ? (max) : (x)))
 
 
 int main(int argc, char *argv[])
 {
-    // ./mark_phase num_nodes num_neighbors num_roots trials prefetch_distance
-    if (argc == 2)
+    // ./mark_phase num_nodes num_neighbors num_roots trials prefetch_distance [prefetchDistance2=N] [threads=N] [layout=aos|soa|bitmap|csr] [queueLog=N]
+    //                 [generator=uniform|powerlaw|locality|tree] [window=N] [reorder=none|bfs|rcm]
+    //                 [seed=N] [initThreads=N] [graph=snapshot_path (the only source of variable degree)] [dumpGraph=snapshot_path] [counters=0|1]
+    //                 [pages=malloc|4k|thp|2m|1g] [populate=0|1] [cacheMB=N] [snapshotDir=path]
+    //                 [ciPercent=X] [budgetMs=N]
+    // ./mark_phase --autotune args_file searches the prefetch distance for every line instead.
+    const int autotune = argc == 3 && strcmp(argv[1], "--autotune") == 0;
+    if (argc == 2 || autotune)
     {
-        FILE *fp = fopen(argv[1], "r");
+        FILE *fp = fopen(argv[argc - 1], "r");
         if (!fp) {
-            printf("Could not open file %s\n", argv[1]);
+            printf("Could not open file %s\n", argv[argc - 1]);
             return 1;
         }
 
-        char line[256];
+        char line[1024];
         while (fgets(line, sizeof(line), fp))
         {
             ConfigT config;
@@ -129,16 +1407,64 @@ int main(int argc, char *argv[])
             {
                 config.numNodes = BOUND(num_nodes, 1ull, 1ull << 30ull);
                 config.numNeighbors = BOUND(num_neighbors, 1ull, MAX_NEIGHBORS);
+                config.layout = getOptionChoice(line, "layout", layoutNames, NUM_LAYOUTS, LAYOUT_AOS);
+                config.graphPath = getOptionString(line, "graph");
+                config.dumpPath = getOptionString(line, "dumpGraph");
+                config.snapshotDir = getOptionString(line, "snapshotDir");
+                if (config.graphPath)
+                {
+                    // A snapshot brings its own size and degrees.
+                    GraphFileHeaderT header;
+                    if (!readGraphHeader(config.graphPath, &header) || !isValidGraphFile(config.graphPath))
+                    {
+                        printf("Could not read graph snapshot %s\n", config.graphPath);
+                        free(config.graphPath);
+                        free(config.dumpPath);
+                        free(config.snapshotDir);
+                        continue;
+                    }
+                    config.numNodes = header.numNodes;
+                    config.numEdges = header.numEdges;
+                    config.numNeighbors = (header.numEdges + header.numNodes - 1ull) / header.numNodes;
+                    config.layout = LAYOUT_CSR;
+                }
+                else
+                {
+                    config.numEdges = (uint64_t)config.numNodes * config.numNeighbors;
+                }
                 config.numRoots = BOUND(num_roots, 1ull, config.numNodes);
                 config.trials = BOUND(trials, 1ull, 1000ull);
+                config.policy = getTrialPolicy(line, config.trials);
                 config.prefetchDistance = BOUND(prefetch_distance, 0ull, config.numNodes);
+                config.prefetchDistance2 = getOptionVal(line, "prefetchDistance2", 0ull, 0ull, config.numNodes);
+                config.threads = getOptionVal(line, "threads", 1ull, 1ull, MAX_THREADS);
+                // No larger than a queue that could hold every push of a trial.
+                const uint64_t maxPushes = config.numEdges + config.numRoots;
+                config.queueLog = MIN(getOptionVal(line, "queueLog", DEFAULT_QUEUE_LOG, 4ull, 30ull),
+                                      (uint64_t)__builtin_ctzll(nextPowerOfTwo(maxPushes)));
+                config.generator = getOptionChoice(line, "generator", generatorNames, NUM_GENERATORS, GENERATOR_UNIFORM);
+                config.window = getOptionVal(line, "window", DEFAULT_WINDOW, 1ull, config.numNodes);
+                config.reorder = getOptionChoice(line, "reorder", reorderNames, NUM_REORDERS, REORDER_NONE);
+                config.seed = getOptionVal(line, "seed", 1ull, 0ull, UINT64_MAX);
+                config.initThreads = getOptionVal(line, "initThreads", getDefaultInitThreads(), 1ull, MAX_INIT_THREADS);
+                config.counters = getOptionVal(line, "counters", 0ull, 0ull, 1ull);
+                config.pages = pagesResolve(getOptionChoice(line, "pages", pageModeNames, NUM_PAGE_MODES, PAGES_MALLOC));
+                config.populate = getOptionVal(line, "populate", 0ull, 0ull, 1ull);
+                if (findOption(line, "cacheMB"))
+                {
+                    datasetCacheSetBudget(getOptionVal(line, "cacheMB", 0ull, 0ull, UINT64_MAX >> 20) << 20);
+                }
                 
-                const ResultT result = testPrefetchDistance(config);
+                const ResultT result = autotune ? autotunePrefetchDistance(&config) : testPrefetchDistance(config);
                 printf("%s,%s\n", configToString(config), resultToString(result));
+                free(config.graphPath);
+                free(config.dumpPath);
+                free(config.snapshotDir);
             }
         }
         
         fclose(fp);
+        datasetCacheClear();
         return 0;
     }
     printf("%s,%s\n", getConfigHeader(), getResultHeader());
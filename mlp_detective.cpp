@@ -1,5 +1,4 @@
 #include <cstddef>
-#include <chrono>
 #include <cassert>
 #include <iostream>
 #include <sstream>
@@ -8,14 +7,29 @@
 #include <array>
 #include <map>
 #include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <numeric>
+#include "fasttime.h"
+#include "perf_counters.h"
+#include "prng.h"
+#include "pages.h"
+#include "containers.h"
+#include "snapshot.h"
+#include "trial_stats.h"
+#include "latency_histogram.h"
+#include "cycle_primes.h"
 
 enum class PatternT
 {
     Cycle,
     Sequential,
-    MediumStride, // 8 - so, every cache line -> L2 prefetcher picks it up, worst-cast bw behavior
-    LongStride    // 512 - so, every 4KB -> L2 prefetcher shouldn't pick this up, but L1 prefetcher would
+    Stride,     // stride=N elements; 'm' is 7 (about every cache line, the L2 prefetcher picks it up), 'l' is 509 (about every 4KB, only the L1 prefetcher would)
+    Permutation // Uniformly random single cycle (Sattolo), drawn from seed=N
 };
+static constexpr size_t NUM_PATTERNS = 4;
 static std::string enumToName(PatternT d)
 {
     switch (d)
@@ -24,10 +38,10 @@ static std::string enumToName(PatternT d)
         return std::string("Cycle");
     case PatternT::Sequential:
         return std::string("Sequential");
-    case PatternT::MediumStride:
-        return std::string("MediumStride");
-    case PatternT::LongStride:
-        return std::string("LongStride");
+    case PatternT::Stride:
+        return std::string("Stride");
+    case PatternT::Permutation:
+        return std::string("Permutation");
     default:
         assert(false); // Unsupported PatternT
     }
@@ -41,19 +55,26 @@ static PatternT characterToPatternT(char c)
     case 's':
         return PatternT::Sequential;
     case 'm':
-        return PatternT::MediumStride;
     case 'l':
-        return PatternT::LongStride;
+    case 't':
+        return PatternT::Stride;
+    case 'p':
+        return PatternT::Permutation;
     default:
         assert(false); // Unsupported PatternT
     }
 }
+static uint64_t characterToDefaultStride(char c)
+{
+    return c == 'm' ? 7ull : (c == 'l' ? 509ull : 1ull);
+}
 
 enum class NextIndexT
 {
     CalculateNext,
     ReadNext
 };
+static constexpr size_t NUM_NEXT_INDICES = 2;
 static std::string enumToName(NextIndexT d)
 {
     switch (d)
@@ -85,7 +106,10 @@ enum class DataStructureT
     Array,
     Vector,
     Map,
-    Unordered_map
+    Unordered_map,
+    FlatHashMap,
+    GroupHashMap,
+    BTree
 };
 
 static std::string enumToName(DataStructureT d)
@@ -100,6 +124,12 @@ static std::string enumToName(DataStructureT d)
         return std::string("Map");
     case DataStructureT::Unordered_map:
         return std::string("Unordered_map");
+    case DataStructureT::FlatHashMap:
+        return std::string("FlatHashMap");
+    case DataStructureT::GroupHashMap:
+        return std::string("GroupHashMap");
+    case DataStructureT::BTree:
+        return std::string("BTree");
     default:
         assert(false); // Unsupported DataStructureT
     }
@@ -117,11 +147,162 @@ static DataStructureT characterToDataStructureT(char c)
         return DataStructureT::Map;
     case 'u':
         return DataStructureT::Unordered_map;
+    case 'f':
+        return DataStructureT::FlatHashMap;
+    case 'g':
+        return DataStructureT::GroupHashMap;
+    case 'b':
+        return DataStructureT::BTree;
     default:
         assert(false); // Unsupported DataStructureT
     }
 }
 
+// Node placement for Map and Unordered_map. Arena and Pool only change where
+// nodes come from; Ordered (Unordered_map only) is an arena that also reserves
+// the buckets up front and always builds in traversal order, so that
+// consecutive accesses touch consecutive nodes. A Map built in traversal
+// order into an arena already has that layout, so Map takes only Arena.
+enum class AllocatorKindT
+{
+    Default,
+    Arena,
+    Pool,
+    Ordered
+};
+
+static std::string enumToName(AllocatorKindT d)
+{
+    switch (d)
+    {
+    case AllocatorKindT::Default:
+        return std::string("Default");
+    case AllocatorKindT::Arena:
+        return std::string("Arena");
+    case AllocatorKindT::Pool:
+        return std::string("Pool");
+    case AllocatorKindT::Ordered:
+        return std::string("Ordered");
+    default:
+        assert(false); // Unsupported AllocatorKindT
+    }
+}
+
+static AllocatorKindT nameToAllocatorKindT(const std::string &name)
+{
+    if (name == "default")
+    {
+        return AllocatorKindT::Default;
+    }
+    if (name == "arena")
+    {
+        return AllocatorKindT::Arena;
+    }
+    if (name == "pool")
+    {
+        return AllocatorKindT::Pool;
+    }
+    assert(name == "ordered"); // Unsupported AllocatorKindT
+    return AllocatorKindT::Ordered;
+}
+
+enum class LoadKindT
+{
+    Read,
+    Write,
+    Triad
+};
+
+static std::string enumToName(LoadKindT d)
+{
+    switch (d)
+    {
+    case LoadKindT::Read:
+        return std::string("Read");
+    case LoadKindT::Write:
+        return std::string("Write");
+    case LoadKindT::Triad:
+        return std::string("Triad");
+    default:
+        assert(false); // Unsupported LoadKindT
+    }
+}
+
+static LoadKindT nameToLoadKindT(const std::string &name)
+{
+    if (name == "read")
+    {
+        return LoadKindT::Read;
+    }
+    if (name == "write")
+    {
+        return LoadKindT::Write;
+    }
+    assert(name == "triad"); // Unsupported LoadKindT
+    return LoadKindT::Triad;
+}
+
+// The order init inserts the pattern's keys in, for every container: the
+// order the traversal will visit them, or ascending keys, as a bulk load that
+// does not know the traversal would.
+enum class InsertOrderT
+{
+    Traversal,
+    Key
+};
+
+static std::string enumToName(InsertOrderT d)
+{
+    switch (d)
+    {
+    case InsertOrderT::Traversal:
+        return std::string("Traversal");
+    case InsertOrderT::Key:
+        return std::string("Key");
+    default:
+        assert(false); // Unsupported InsertOrderT
+    }
+}
+
+static InsertOrderT nameToInsertOrderT(const std::string &name)
+{
+    if (name == "traversal")
+    {
+        return InsertOrderT::Traversal;
+    }
+    assert(name == "key"); // Unsupported InsertOrderT
+    return InsertOrderT::Key;
+}
+
+static PageModeT nameToPageModeT(const std::string &name)
+{
+    for (int i = 0; i < NUM_PAGE_MODES; i++)
+    {
+        if (name == pageModeNames[i])
+        {
+            return static_cast<PageModeT>(i);
+        }
+    }
+    assert(false); // Unsupported PageModeT
+    return PAGES_MALLOC;
+}
+
+// Lets std::vector take its buffer from pagesAlloc.
+template <typename T>
+struct PageAllocatorT
+{
+    using value_type = T;
+    PageModeT pages;
+    bool populate;
+
+    PageAllocatorT(PageModeT pages, bool populate) : pages(pages), populate(populate) {}
+    template <typename U>
+    PageAllocatorT(const PageAllocatorT<U> &other) : pages(other.pages), populate(other.populate) {}
+    T *allocate(size_t n) { return static_cast<T *>(pagesAlloc(sizeof(T) * n, pages, populate)); }
+    void deallocate(T *ptr, size_t) { pagesFree(ptr); }
+    bool operator==(const PageAllocatorT &other) const { return pages == other.pages && populate == other.populate; }
+};
+
 struct ConfigT
 {
     PatternT pattern;
@@ -131,11 +312,52 @@ struct ConfigT
     uint64_t p;
     uint64_t blockLog;
     uint64_t trials;
+    TrialPolicyT policy;
+    uint64_t stride; // Stride only
+    uint64_t seed;   // Permutation only
+    const uint64_t *permutation; // Permutation only: element i's successor
+    uint64_t chains; // Independent cursors; blockLog is 0 when this is above 1
+    bool counters;
+    PageModeT pages; // Array and Vector only; the other containers always report malloc
+    bool populate;
+    AllocatorKindT allocator; // Map and Unordered_map only
+    InsertOrderT insertOrder; // Always Traversal with the Ordered allocator
+    uint64_t loadThreads; // Bandwidth generators running alongside the chase
+    LoadKindT loadKind;
+    uint64_t loadBytesLog; // Per generator thread
+    uint64_t loadPause;    // Pause instructions after every 4 KiB a generator streams
+    uint64_t latencyEvery; // Time every Nth access in sampled passes, 0 for none
+    std::string snapshotDir; // Array only: where its contents are mapped from or saved to
+    bool prebuilt;           // The container already holds the pattern
 
-    static std::string getHeader() { return std::string("HW10,pLog,totalKB,p,containerFamily,pattern,nextIndex,blockLog,trials"); }
+    static std::string getHeader() { return std::string("HW10,pLog,totalKB,p,containerFamily,pattern,stride,seed,nextIndex,blockLog,trials,ciPercent,budgetMs,chains,pages,populate,loadThreads,loadKind,loadBytesLog,loadPause,insertOrder"); }
+    std::string getContainerName() const
+    {
+        std::string name = enumToName(containerFamily);
+        if (allocator != AllocatorKindT::Default)
+        {
+            name += '_';
+            name += enumToName(allocator);
+        }
+        return name;
+    }
+    // The two baseline strides keep the names they had before strides were
+    // a parameter, so that existing plots still group by them.
+    std::string getPatternName() const
+    {
+        if (pattern == PatternT::Stride && stride == 7ull)
+        {
+            return std::string("MediumStride");
+        }
+        if (pattern == PatternT::Stride && stride == 509ull)
+        {
+            return std::string("LongStride");
+        }
+        return enumToName(pattern);
+    }
     std::string toString() const
     {
-        return "HW10," + std::to_string(pLog) + "," + std::to_string(static_cast<double>(p) / 128.0) + "," + std::to_string(p) + "," + enumToName(containerFamily) + "," + enumToName(pattern) + "," + enumToName(nextIndex) + "," + std::to_string(blockLog) + "," + std::to_string(trials);
+        return "HW10," + std::to_string(pLog) + "," + std::to_string(static_cast<double>(p) / 128.0) + "," + std::to_string(p) + "," + getContainerName() + "," + getPatternName() + "," + std::to_string(stride) + "," + std::to_string(seed) + "," + enumToName(nextIndex) + "," + std::to_string(blockLog) + "," + std::to_string(trials) + "," + std::to_string(policy.ciPercent) + "," + std::to_string(policy.budgetMs) + "," + std::to_string(chains) + "," + pageModeNames[pages] + "," + std::to_string(populate) + "," + std::to_string(loadThreads) + "," + enumToName(loadKind) + "," + std::to_string(loadBytesLog) + "," + std::to_string(loadPause) + "," + enumToName(insertOrder);
     }
 };
 
@@ -143,14 +365,42 @@ struct ResultT
 {
     uint64_t loopSum;
     double nsPerAccess;
+    PerfSampleT perAccess;
+    double loadGBps; // Aggregate generator traffic over all trials, 0 when unloaded
+    TrialStatsT stats{}; // nsPerAccess over all trials
+    LatencySummaryT latency = latencyNone(); // Sampled passes, if latencyEvery is set
 
-    static std::string getHeader() { return std::string("loopSum,nsPerAccess"); }
-    std::string toString() const { return std::to_string(loopSum) + "," + std::to_string(nsPerAccess); }
+    static std::string getHeader() { return std::string("loopSum,nsPerAccess,loadGBps,") + trialStatsGetHeader() + "," + latencyGetHeader() + "," + perfGetHeader(); }
+    std::string toString() const
+    {
+        char counters[256];
+        char statsString[256];
+        char latencyString[256];
+        perfToString(perAccess, counters, sizeof(counters));
+        trialStatsToString(stats, statsString, sizeof(statsString));
+        latencyToString(latency, latencyString, sizeof(latencyString));
+        return std::to_string(loopSum) + "," + std::to_string(nsPerAccess) + "," + std::to_string(loadGBps) + "," + statsString + "," + latencyString + "," + counters;
+    }
+};
+
+// What getNext needs at run time. Every pattern is a single cycle over
+// 1 .. P - 1.
+struct PatternArgsT
+{
+    uint64_t P;
+    uint64_t stride;
+    const uint64_t *permutation;
 };
 
+static inline PatternArgsT getPatternArgs(const ConfigT &config)
+{
+    return PatternArgsT({config.p, config.stride, config.permutation});
+}
+
 template <PatternT Pattern>
-static inline uint64_t getNext(const uint64_t index, const uint64_t P)
+static inline uint64_t getNext(const uint64_t index, const PatternArgsT &args)
 {
+    const uint64_t P = args.P;
     if constexpr (Pattern == PatternT::Cycle)
     {
         auto next = index << 1ull;
@@ -160,37 +410,63 @@ static inline uint64_t getNext(const uint64_t index, const uint64_t P)
     {
         return index >= (P - 1) ? 1ull : index + 1;
     }
-    else if constexpr (Pattern == PatternT::MediumStride)
+    else if constexpr (Pattern == PatternT::Stride)
     {
-        const auto next = index + 7; // assumes P > 7
+        const auto next = index + args.stride; // stride < P - 1, coprime with it
         return next >= P ? next - (P - 1) : next;
     }
-    else if constexpr (Pattern == PatternT::LongStride)
+    else if constexpr (Pattern == PatternT::Permutation)
     {
-        const auto next = index + 509; // assumes P > 509
-        return next >= P ? next - (P - 1) : next;
+        return args.permutation[index];
     }
 }
 
+// Smallest stride at or above the requested one that still visits every
+// element, i.e. is coprime with P - 1.
+static inline uint64_t getSupportedStride(const uint64_t stride, const uint64_t P)
+{
+    uint64_t supported = std::clamp<uint64_t>(stride, 1ull, P - 2);
+    while (std::gcd(supported, P - 1) != 1ull)
+    {
+        supported = supported + 1 == P - 1 ? 1ull : supported + 1;
+    }
+    return supported;
+}
+
+// Sattolo's shuffle of the identity over 1 .. P - 1: unlike Fisher-Yates it
+// only produces permutations that are a single cycle, and each of those with
+// equal probability. Draw i depends only on (seed, i).
+static inline std::vector<uint64_t> getPermutation(const uint64_t P, const uint64_t seed)
+{
+    std::vector<uint64_t> permutation(P);
+    std::iota(permutation.begin(), permutation.end(), 0ull);
+    const uint64_t key = prngKey(seed, 0ull);
+    for (uint64_t i = P - 1; i > 1; i--)
+    {
+        std::swap(permutation[i], permutation[1 + prngBelow(prngAt(key, i), i - 1)]);
+    }
+    return permutation;
+}
+
 template <typename ContainerT, PatternT Pattern>
-static inline void init(ContainerT &data, const uint64_t P)
+static inline void init(ContainerT &data, const PatternArgsT &args)
 {
     uint64_t index = 1ull;
-    for (uint64_t i = 0; i < P; i++)
+    for (uint64_t i = 0; i < args.P; i++)
     {
-        const auto next = getNext<Pattern>(index, P);
+        const auto next = getNext<Pattern>(index, args);
         data[index] = next;
         index = next;
     }
 }
 
 template <typename ContainerT, PatternT Pattern, NextIndexT Next>
-static inline void traverseNext(ContainerT &data, const uint64_t P, uint64_t &index, uint64_t &loopSum)
+static inline void traverseNext(ContainerT &data, const PatternArgsT &args, uint64_t &index, uint64_t &loopSum)
 {
     loopSum += data[index];
     if constexpr (Next == NextIndexT::CalculateNext)
     {
-        index = getNext<Pattern>(index, P);
+        index = getNext<Pattern>(index, args);
     }
     else if constexpr (Next == NextIndexT::ReadNext)
     {
@@ -206,105 +482,378 @@ static inline ResultT traverseOnetrial(const ConfigT config, ContainerT &data)
     uint64_t index = 1ull;
     uint64_t loopSum = 0ull;
     const uint64_t P = config.p;
+    const PatternArgsT args = getPatternArgs(config);
     const uint64_t numBlocks = (P - 1) >> B_Log;
     const uint64_t remainderElements = (P - 1) & remainderMask;
 
-    const auto t1 = std::chrono::high_resolution_clock::now();
+    perfStart(config.counters);
+    const fasttime_t t1 = gettime();
 
     for (uint64_t i = 0; i < numBlocks; i++)
     {
         for (uint64_t j = 0; j < blockSize; j++)
         {
-            traverseNext<ContainerT, Pattern, Next>(data, P, index, loopSum);
+            traverseNext<ContainerT, Pattern, Next>(data, args, index, loopSum);
         }
     }
     for (uint64_t i = 0; i < remainderElements; i++)
     {
-        traverseNext<ContainerT, Pattern, Next>(data, P, index, loopSum);
+        traverseNext<ContainerT, Pattern, Next>(data, args, index, loopSum);
     }
-    const auto t2 = std::chrono::high_resolution_clock::now();
-    const std::chrono::duration<double, std::nano> duration = t2 - t1;
-    const auto nsPerAccess = duration.count() / static_cast<double>(P - 1);
-    return ResultT({loopSum, nsPerAccess});
+    const fasttime_t t2 = gettime();
+    const auto sample = perfStop(config.counters);
+    const auto nsPerAccess = tdiff(t1, t2) * 1e9 / static_cast<double>(P - 1);
+    return ResultT({loopSum, nsPerAccess, perfPerAccess(sample, static_cast<double>(P - 1)), 0.0});
 }
 
-template <typename ContainerT, PatternT Pattern, NextIndexT Next, uint64_t B_Log>
-static inline ResultT traverse(const ConfigT config, ContainerT &data)
+// Loaded-latency mode: loadThreads threads stream over buffers of their own
+// while the chase runs, so that its latency is measured against a known
+// amount of background bandwidth. Generators allocate and fill their buffers,
+// then wait until all of them are ready before any traffic is counted.
+static constexpr uint64_t LOAD_CHUNK_ELEMENTS = 4096 / sizeof(uint64_t);
+
+struct LoadGeneratorT
 {
-    std::vector<ResultT> results;
-    for (uint64_t i = 0ull; i < config.trials; i++)
+    const ConfigT config;
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> numReady{0};
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> bytes{0};
+    fasttime_t t1;
+
+    explicit LoadGeneratorT(const ConfigT config) : config(config)
+    {
+        for (uint64_t i = 0; i < config.loadThreads; i++)
+        {
+            threads.emplace_back([this] { generate(); });
+        }
+        while (numReady.load() < config.loadThreads)
+        {
+            std::this_thread::yield();
+        }
+        t1 = gettime();
+        running.store(true);
+    }
+
+    // Stops the generators and returns their aggregate GB/s.
+    double stop()
     {
-        results.push_back(traverseOnetrial<ContainerT, Pattern, Next, B_Log>(config, data));
+        if (config.loadThreads == 0)
+        {
+            return 0.0;
+        }
+        stopping.store(true);
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        return static_cast<double>(bytes.load()) / (tdiff(t1, gettime()) * 1e9);
     }
-    ResultT bestResult = results[0];
-    for (uint64_t i = 1ull; i < config.trials; i++)
+
+    void generate()
     {
-        assert(bestResult.loopSum == results[i].loopSum);
-        if (results[i].nsPerAccess < bestResult.nsPerAccess)
+        // Triad streams over three arrays, so each gets a third of the bytes.
+        const uint64_t numArrays = config.loadKind == LoadKindT::Triad ? 3 : 1;
+        const uint64_t length = std::max<uint64_t>((1ull << config.loadBytesLog) / sizeof(uint64_t) / numArrays, LOAD_CHUNK_ELEMENTS) / LOAD_CHUNK_ELEMENTS * LOAD_CHUNK_ELEMENTS;
+        std::vector<uint64_t> a(length, 1ull), b(length, 2ull), c(numArrays == 3 ? length : 0, 3ull);
+        uint64_t sum = 0ull;
+        uint64_t chunks = 0ull;
+        numReady.fetch_add(1);
+        while (!running.load(std::memory_order_relaxed))
         {
-            bestResult = results[i];
+            std::this_thread::yield();
         }
+        for (uint64_t base = 0; !stopping.load(std::memory_order_relaxed); base = base + LOAD_CHUNK_ELEMENTS == length ? 0 : base + LOAD_CHUNK_ELEMENTS)
+        {
+            switch (config.loadKind)
+            {
+            case LoadKindT::Read:
+                for (uint64_t i = base; i < base + LOAD_CHUNK_ELEMENTS; i++)
+                {
+                    sum += a[i];
+                }
+                break;
+            case LoadKindT::Write:
+                for (uint64_t i = base; i < base + LOAD_CHUNK_ELEMENTS; i++)
+                {
+                    a[i] = i;
+                }
+                break;
+            case LoadKindT::Triad:
+                for (uint64_t i = base; i < base + LOAD_CHUNK_ELEMENTS; i++)
+                {
+                    a[i] = b[i] + 3ull * c[i];
+                }
+                break;
+            }
+            for (uint64_t i = 0; i < config.loadPause; i++)
+            {
+                __builtin_ia32_pause();
+            }
+            chunks++;
+        }
+        bytes.fetch_add(chunks * numArrays * LOAD_CHUNK_ELEMENTS * sizeof(uint64_t));
+        // Keeps the read loop from being optimised away.
+        static std::atomic<uint64_t> sink;
+        sink.fetch_add(sum + a[0], std::memory_order_relaxed);
     }
+};
+
+// K-chain mode: K cursors start at evenly spaced points of the cycle and
+// advance in lockstep, each over its own segment, so that with ReadNext up to
+// K independent misses are outstanding. Segments differ in length by at most
+// one, and the cursors with a longer segment take one extra step at the end,
+// so loopSum is the single-chain sum. nsPerAccess is still per element.
+//
+// Each K is its own kernel, and every K in 1 .. MAX_CHAINS is compiled in,
+// so that the line-fill buffer knee can fall on any count.
+static constexpr uint64_t MAX_CHAINS = 32;
+
+template <uint64_t... Ks>
+static constexpr auto offsetByOne(std::integer_sequence<uint64_t, Ks...>)
+{
+    return std::integer_sequence<uint64_t, (Ks + 1)...>();
+}
+using ChainCountsT = decltype(offsetByOne(std::make_integer_sequence<uint64_t, MAX_CHAINS>()));
+
+template <PatternT Pattern>
+static inline std::vector<uint64_t> getChainStarts(const PatternArgsT &args, const uint64_t K)
+{
+    const uint64_t P = args.P;
+    std::vector<uint64_t> starts;
+    uint64_t index = 1ull;
+    for (uint64_t step = 0, k = 0; k < K; step++)
+    {
+        if (step == k * (P - 1) / K)
+        {
+            starts.push_back(index);
+            k++;
+        }
+        index = getNext<Pattern>(index, args);
+    }
+    return starts;
+}
+
+// Only the start points depend on the pattern: every cursor reads its next
+// index, so the kernel is shared by all patterns.
+template <typename ContainerT, uint64_t K>
+static inline ResultT traverseChainsOnetrial(const ConfigT config, ContainerT &data, const std::vector<uint64_t> &starts)
+{
+    const uint64_t P = config.p;
+    const PatternArgsT args = getPatternArgs(config);
+    const uint64_t steps = (P - 1) / K;
+    uint64_t index[K];
+    bool extra[K];
+    for (uint64_t k = 0; k < K; k++)
+    {
+        index[k] = starts[k];
+        extra[k] = (k + 1) * (P - 1) / K - k * (P - 1) / K > steps;
+    }
+    uint64_t loopSum = 0ull;
+
+    perfStart(config.counters);
+    const fasttime_t t1 = gettime();
+
+    for (uint64_t i = 0; i < steps; i++)
+    {
+        for (uint64_t k = 0; k < K; k++)
+        {
+            traverseNext<ContainerT, PatternT::Cycle, NextIndexT::ReadNext>(data, args, index[k], loopSum);
+        }
+    }
+    for (uint64_t k = 0; k < K; k++)
+    {
+        if (extra[k])
+        {
+            traverseNext<ContainerT, PatternT::Cycle, NextIndexT::ReadNext>(data, args, index[k], loopSum);
+        }
+    }
+    const fasttime_t t2 = gettime();
+    const auto sample = perfStop(config.counters);
+    const auto nsPerAccess = tdiff(t1, t2) * 1e9 / static_cast<double>(P - 1);
+    return ResultT({loopSum, nsPerAccess, perfPerAccess(sample, static_cast<double>(P - 1)), 0.0});
+}
+
+// The walk of traverseOnetrial, unblocked, with every Nth access timed on
+// its own. Blocking and chains only change how accesses overlap, which the
+// stamps take away, so one walk per pattern serves them all.
+template <typename ContainerT, PatternT Pattern, NextIndexT Next>
+static uint64_t traverseSampled(const ConfigT config, ContainerT &data, LatencyHistogramT &histogram)
+{
+    uint64_t index = 1ull;
+    uint64_t loopSum = 0ull;
+    uint64_t countdown = config.latencyEvery;
+    const PatternArgsT args = getPatternArgs(config);
+    for (uint64_t i = 0; i < config.p - 1; i++)
+    {
+        if (--countdown == 0ull)
+        {
+            countdown = config.latencyEvery;
+            const fasttime_t t1 = gettime();
+            traverseNext<ContainerT, Pattern, Next>(data, args, index, loopSum);
+            const fasttime_t t2 = gettime();
+            latencyHistogramAdd(&histogram, t1, t2);
+        }
+        else
+        {
+            traverseNext<ContainerT, Pattern, Next>(data, args, index, loopSum);
+        }
+    }
+    return loopSum;
+}
+
+// Every sampled pass has to produce the trials' loopSum, which also keeps
+// its loads from being optimized away.
+template <typename ContainerT, PatternT Pattern, NextIndexT Next>
+static LatencySummaryT testLatency(const ConfigT config, ContainerT &data, const ResultT &result)
+{
+    if (config.latencyEvery == 0ull)
+    {
+        return latencyNone();
+    }
+    const uint64_t passes = latencyGetPasses(config.p - 1, config.latencyEvery);
+    LatencyHistogramT histogram;
+    latencyHistogramReset(&histogram);
+    const fasttime_t t1 = gettime();
+    for (uint64_t pass = 0ull; pass < passes; pass++)
+    {
+        const uint64_t loopSum = traverseSampled<ContainerT, Pattern, Next>(config, data, histogram);
+        assert(loopSum == result.loopSum);
+        (void)loopSum;
+    }
+    const fasttime_t t2 = gettime();
+    return latencySummarize(&histogram, config.latencyEvery, tdiff(t1, t2) * 1e9 / static_cast<double>(passes * (config.p - 1)), result.nsPerAccess);
+}
+
+// Runs the trials with the load generators going, until the trial policy is
+// met, and keeps the fastest. The sampled latency passes run under the same
+// load.
+template <typename TrialFnT, typename LatencyFnT>
+static inline ResultT runTrials(const ConfigT config, TrialFnT trial, LatencyFnT latency)
+{
+    LoadGeneratorT load(config);
+    TrialSamplesT samples = {{0.0}, 0u, 0.0};
+    ResultT bestResult = trial();
+    trialSamplesAdd(&samples, bestResult.nsPerAccess, bestResult.nsPerAccess * static_cast<double>(config.p - 1) / 1e6);
+    while (!trialsDone(&samples, config.policy))
+    {
+        const ResultT result = trial();
+        trialSamplesAdd(&samples, result.nsPerAccess, result.nsPerAccess * static_cast<double>(config.p - 1) / 1e6);
+        assert(bestResult.loopSum == result.loopSum);
+        if (result.nsPerAccess < bestResult.nsPerAccess)
+        {
+            bestResult = result;
+        }
+    }
+    bestResult.latency = latency(bestResult);
+    bestResult.loadGBps = load.stop();
+    bestResult.stats = trialStatsCompute(&samples);
     return bestResult;
 }
 
 template <typename ContainerT, PatternT Pattern, NextIndexT Next, uint64_t B_Log>
-static inline ResultT testTraversal(const ConfigT config, ContainerT &data)
+static inline ResultT traverse(const ConfigT config, ContainerT &data)
 {
-    init<ContainerT, Pattern>(data, config.p);
-    return traverse<ContainerT, Pattern, Next, B_Log>(config, data);
+    return runTrials(config, [&] { return traverseOnetrial<ContainerT, Pattern, Next, B_Log>(config, data); },
+                     [&](const ResultT &result) { return testLatency<ContainerT, Pattern, Next>(config, data, result); });
+}
+
+template <typename ContainerT, PatternT Pattern, uint64_t... Ks>
+static inline ResultT traverseChains(const ConfigT config, ContainerT &data, const std::vector<uint64_t> &starts, std::integer_sequence<uint64_t, Ks...>)
+{
+    using TrialFnT = ResultT (*)(const ConfigT, ContainerT &, const std::vector<uint64_t> &);
+    static constexpr TrialFnT table[] = {&traverseChainsOnetrial<ContainerT, Ks>...}; // table[K - 1]
+    assert(config.chains >= 1 && config.chains <= sizeof...(Ks)); // Unsupported chain count
+    return runTrials(config, [&] { return table[config.chains - 1](config, data, starts); },
+                     [&](const ResultT &result) { return testLatency<ContainerT, Pattern, NextIndexT::ReadNext>(config, data, result); });
 }
 
-template <typename ContainerT, PatternT Pattern, uint64_t B_Log>
-static inline ResultT testNextIndex(const ConfigT config, ContainerT &data)
+// Same contents as init, inserted in ascending key order. Every pattern
+// visits exactly the keys 1 .. P - 1.
+template <typename ContainerT, PatternT Pattern>
+static inline void initInKeyOrder(ContainerT &data, const PatternArgsT &args)
 {
-    switch (config.nextIndex)
+    for (uint64_t index = 1ull; index < args.P; index++)
     {
-    case NextIndexT::CalculateNext:
-        return testTraversal<ContainerT, Pattern, NextIndexT::CalculateNext, B_Log>(config, data);
-    case NextIndexT::ReadNext:
-        return testTraversal<ContainerT, Pattern, NextIndexT::ReadNext, B_Log>(config, data);
-    default:
-        assert(false); // Unsupported NextIndexT
+        data[index] = getNext<Pattern>(index, args);
     }
 }
 
-template <typename ContainerT, uint64_t B_Log>
-static inline ResultT testAccessPattern(const ConfigT config, ContainerT &data)
+template <typename ContainerT, PatternT Pattern, NextIndexT Next, uint64_t B_Log>
+static inline ResultT testTraversal(const ConfigT config, ContainerT &data)
 {
-    switch (config.pattern)
+    if (!config.prebuilt && config.insertOrder == InsertOrderT::Key)
     {
-    case PatternT::Cycle:
-        return testNextIndex<ContainerT, PatternT::Cycle, B_Log>(config, data);
-    case PatternT::Sequential:
-        return testNextIndex<ContainerT, PatternT::Sequential, B_Log>(config, data);
-    case PatternT::MediumStride:
-        return testNextIndex<ContainerT, PatternT::MediumStride, B_Log>(config, data);
-    case PatternT::LongStride:
-        return testNextIndex<ContainerT, PatternT::LongStride, B_Log>(config, data);
-    default:
-        assert(false); // Unsupported PatternT
+        initInKeyOrder<ContainerT, Pattern>(data, getPatternArgs(config));
     }
+    else if (!config.prebuilt)
+    {
+        init<ContainerT, Pattern>(data, getPatternArgs(config));
+    }
+    if constexpr (B_Log == 0 && Next == NextIndexT::ReadNext)
+    {
+        if (config.chains > 1)
+        {
+            return traverseChains<ContainerT, Pattern>(config, data, getChainStarts<Pattern>(getPatternArgs(config), config.chains), ChainCountsT());
+        }
+    }
+    return traverse<ContainerT, Pattern, Next, B_Log>(config, data);
+}
+
+// Every (blockLog, pattern, nextIndex) combination is one instantiation of
+// testTraversal, laid out in a table generated from an index sequence, so a
+// new pattern or block size only needs its count bumped.
+static constexpr uint64_t MAX_BLOCK_LOG = 6;
+static constexpr size_t NUM_TRAVERSALS = (MAX_BLOCK_LOG + 1) * NUM_PATTERNS * NUM_NEXT_INDICES;
+
+template <typename ContainerT, size_t I>
+static inline ResultT testTraversalAt(const ConfigT config, ContainerT &data)
+{
+    constexpr uint64_t B_Log = I / (NUM_PATTERNS * NUM_NEXT_INDICES);
+    constexpr PatternT Pattern = static_cast<PatternT>(I / NUM_NEXT_INDICES % NUM_PATTERNS);
+    constexpr NextIndexT Next = static_cast<NextIndexT>(I % NUM_NEXT_INDICES);
+    return testTraversal<ContainerT, Pattern, Next, B_Log>(config, data);
+}
+
+template <typename ContainerT, size_t... Is>
+static inline ResultT testTraversal(const ConfigT config, ContainerT &data, std::index_sequence<Is...>)
+{
+    using TestFnT = ResultT (*)(const ConfigT, ContainerT &);
+    static constexpr TestFnT table[] = {&testTraversalAt<ContainerT, Is>...};
+    const size_t i = (config.blockLog * NUM_PATTERNS + static_cast<size_t>(config.pattern)) * NUM_NEXT_INDICES + static_cast<size_t>(config.nextIndex);
+    assert(i < sizeof...(Is)); // Unsupported block size
+    return table[i](config, data);
 }
 
 template <typename ContainerT>
 static inline ResultT testBlockingFactor(const ConfigT config, ContainerT &data)
 {
-    switch (config.blockLog)
-    {
-    case 0:
-        return testAccessPattern<ContainerT, 0>(config, data);
-    case 1:
-        return testAccessPattern<ContainerT, 1>(config, data);
-    case 2:
-        return testAccessPattern<ContainerT, 2>(config, data);
-    case 3:
-        return testAccessPattern<ContainerT, 3>(config, data);
-    case 4:
-        return testAccessPattern<ContainerT, 4>(config, data);
-    default:
-        assert(false); // Unsupported block size
+    return testTraversal(config, data, std::make_index_sequence<NUM_TRAVERSALS>());
+}
+
+using PairT = std::pair<const uint64_t, uint64_t>;
+
+template <typename ResourceT>
+static inline ResultT testMap(const ConfigT config)
+{
+    ResourceT resource;
+    using MapT = std::map<uint64_t, uint64_t, std::less<uint64_t>, ResourceAllocatorT<PairT, ResourceT>>;
+    MapT data{ResourceAllocatorT<PairT, ResourceT>(&resource)};
+    return testBlockingFactor<MapT>(config, data);
+}
+
+template <typename ResourceT>
+static inline ResultT testUnorderedMap(const ConfigT config)
+{
+    ResourceT resource;
+    using MapT = std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, ResourceAllocatorT<PairT, ResourceT>>;
+    MapT data{ResourceAllocatorT<PairT, ResourceT>(&resource)};
+    if (config.allocator == AllocatorKindT::Ordered)
+    {
+        data.reserve(config.p);
     }
+    return testBlockingFactor<MapT>(config, data);
 }
 
 static inline ResultT testDataStructure(const ConfigT config)
@@ -313,26 +862,87 @@ static inline ResultT testDataStructure(const ConfigT config)
     {
     case DataStructureT::Array:
     {
-        uint64_t *data = new uint64_t[config.p];
-        const auto result = testBlockingFactor<uint64_t *>(config, data);
-        delete[] data;
+        // Only the array can be used straight from a snapshot mapping, and
+        // only on malloc pages; traversals never write it, so it is saved
+        // after the run.
+        const DatasetKeyT key = {{config.p, static_cast<uint64_t>(config.pattern), config.stride, config.seed}};
+        std::string path;
+        SnapshotT snapshot = {};
+        if (!config.snapshotDir.empty())
+        {
+            char *snapshotFile = snapshotPath(config.snapshotDir.c_str(), "mlp", &key);
+            path = snapshotFile;
+            free(snapshotFile);
+        }
+        if (!path.empty() && config.pages == PAGES_MALLOC)
+        {
+            snapshot = snapshotMap(path.c_str(), &key, config.populate);
+        }
+        ConfigT arrayConfig = config;
+        arrayConfig.prebuilt = snapshot.mapping != nullptr;
+        uint64_t *data = static_cast<uint64_t *>(arrayConfig.prebuilt ? snapshot.sections[0] : pagesAlloc(sizeof(uint64_t) * config.p, config.pages, config.populate));
+        const auto result = testBlockingFactor<uint64_t *>(arrayConfig, data);
+        if (arrayConfig.prebuilt)
+        {
+            snapshotUnmap(&snapshot);
+            return result;
+        }
+        if (!path.empty())
+        {
+            const void *sections[] = {data};
+            const uint64_t bytes = sizeof(uint64_t) * config.p;
+            snapshotWrite(path.c_str(), &key, 1u, sections, &bytes);
+        }
+        pagesFree(data);
         return result;
     }
     case DataStructureT::Vector:
     {
-        std::vector<uint64_t> data(config.p, 0ull);
-        return testBlockingFactor<std::vector<uint64_t>>(config, data);
+        using VectorT = std::vector<uint64_t, PageAllocatorT<uint64_t>>;
+        VectorT data(config.p, 0ull, PageAllocatorT<uint64_t>(config.pages, config.populate));
+        return testBlockingFactor<VectorT>(config, data);
     }
     case DataStructureT::Map:
     {
+        if (config.allocator == AllocatorKindT::Pool)
+        {
+            return testMap<PoolT>(config);
+        }
+        if (config.allocator != AllocatorKindT::Default)
+        {
+            return testMap<ArenaT>(config);
+        }
         std::map<uint64_t, uint64_t> data;
         return testBlockingFactor<std::map<uint64_t, uint64_t>>(config, data);
     }
     case DataStructureT::Unordered_map:
     {
+        if (config.allocator == AllocatorKindT::Pool)
+        {
+            return testUnorderedMap<PoolT>(config);
+        }
+        if (config.allocator != AllocatorKindT::Default)
+        {
+            return testUnorderedMap<ArenaT>(config);
+        }
         std::unordered_map<uint64_t, uint64_t> data;
         return testBlockingFactor<std::unordered_map<uint64_t, uint64_t>>(config, data);
     }
+    case DataStructureT::FlatHashMap:
+    {
+        FlatHashMapT data(config.p);
+        return testBlockingFactor<FlatHashMapT>(config, data);
+    }
+    case DataStructureT::GroupHashMap:
+    {
+        GroupHashMapT data(config.p);
+        return testBlockingFactor<GroupHashMapT>(config, data);
+    }
+    case DataStructureT::BTree:
+    {
+        BTreeT data(config.p);
+        return testBlockingFactor<BTreeT>(config, data);
+    }
     default:
         assert(false); // Unsupported DataStructureT
     }
@@ -351,6 +961,9 @@ void getPrimes(uint64_t p_start, uint64_t p_end)
 
             std::vector<bool> visited(p, false);
             bool isPrimitiveRoot = true;
+            const PatternArgsT args = PatternArgsT({p, 1ull, nullptr});
+            const PatternArgsT mediumArgs = PatternArgsT({p, 7ull, nullptr});
+            const PatternArgsT longArgs = PatternArgsT({p, 509ull, nullptr});
 
             for (uint64_t k = 1; k < p; k++)
             {
@@ -358,10 +971,10 @@ void getPrimes(uint64_t p_start, uint64_t p_end)
                 {
                     sums[m] += index[m];
                 }
-                index[0] = getNext<PatternT::Cycle>(index[0], p);
-                index[1] = getNext<PatternT::Sequential>(index[1], p);
-                index[2] = getNext<PatternT::MediumStride>(index[2], p);
-                index[3] = getNext<PatternT::LongStride>(index[3], p);
+                index[0] = getNext<PatternT::Cycle>(index[0], args);
+                index[1] = getNext<PatternT::Sequential>(index[1], args);
+                index[2] = getNext<PatternT::Stride>(index[2], mediumArgs);
+                index[3] = getNext<PatternT::Stride>(index[3], longArgs);
 
                 isPrimitiveRoot &= !visited[index[0]];
                 visited[index[0]] = true;
@@ -396,11 +1009,28 @@ static const IntegralType charStarToVal(char *argv, IntegralType minVal, Integra
     assert(false); // Invalid range
 }
 
+// Optional settings follow the six positional arguments as "key=value" tokens.
+static std::string getOption(const std::vector<std::string> &args, const std::string &key, const std::string &defaultValue)
+{
+    std::string value = defaultValue;
+    for (uint64_t i = 6; i < args.size(); i++)
+    {
+        if (args[i].rfind(key + "=", 0) == 0)
+        {
+            value = args[i].substr(key.size() + 1);
+        }
+    }
+    return value;
+}
+
 int main(int argc, char *argv[])
 {
     // getPrimes(10, 25);
-    // mlp_detective data_structure{a,v,m,u} pattern{c,s,m,l} nextIndex{r,c} pow_log[10:25] block_log[0:4] trials
+    // mlp_detective data_structure{a,v,m,u,f,g,b} pattern{c,s,m,l,t,p} nextIndex{r,c} pow_log[10:25] block_log[0:6] trials [stride=N] [seed=N] [chains=1..32 (1 with nextIndex c)] [counters=0|1]
+    //               [pages=malloc|4k|thp|2m|1g] [populate=0|1] [allocator=default|arena|pool|ordered] [insertOrder=traversal|key] [loadThreads=N] [loadKind=read|write|triad] [loadBytesLog=N] [loadPause=N] [snapshotDir=path]
+    //               [ciPercent=X] [budgetMs=N] [latencyEvery=N] [totalKB=N]
     std::vector<uint64_t> primes({947, 2029, 4093, 8179, 16363, 32749, 65371, 131059, 262139, 524269, 1048571, 2097133, 4194187, 8388587, 16776989, 33554371});
+    assert(cyclePrimesTableIsValid(primes.data(), primes.size(), 10)); // primes[pLog - 10] belongs to 2^pLog
 
     if (argc == 2)
     {
@@ -417,15 +1047,71 @@ int main(int argc, char *argv[])
                 args.push_back(arg);
             }
             
-            if (args.size() == 6) {
+            if (args.size() >= 6) {
                 ConfigT config;
                 config.containerFamily = characterToDataStructureT(args[0][0]);
                 config.pattern = characterToPatternT(args[1][0]);
                 config.nextIndex = characterToNextIndexT(args[2][0]);
                 config.pLog = std::stoul(args[3]) - 3;
                 config.p = primes[config.pLog - 10];
-                config.blockLog = std::stoul(args[4]);
+                if (!getOption(args, "totalKB", "").empty())
+                {
+                    // Any size between the table's, for sampling around cache boundaries.
+                    config.p = cyclePrimeAtMost(std::clamp(std::stoul(getOption(args, "totalKB", "")) * 128ul, primes.front(), primes.back()));
+                    config.pLog = 64 - __builtin_clzll(config.p - 1); // ceil(log2 P), as for the table's primes
+                }
+                config.blockLog = std::min<uint64_t>(std::stoul(args[4]), MAX_BLOCK_LOG);
                 config.trials = std::stoul(args[5]);
+                config.policy = TrialPolicyT{static_cast<uint32_t>(std::clamp(config.trials, 1ul, static_cast<uint64_t>(MAX_TRIALS))),
+                                             std::clamp(std::stod(getOption(args, "ciPercent", "0")), 0.0, 100.0),
+                                             std::max(std::stod(getOption(args, "budgetMs", "10000")), 1.0)};
+                config.stride = 0ull;
+                if (config.pattern == PatternT::Stride)
+                {
+                    config.stride = getSupportedStride(std::stoul(getOption(args, "stride", std::to_string(characterToDefaultStride(args[1][0])))), config.p);
+                }
+                config.seed = 0ull;
+                std::vector<uint64_t> permutation;
+                if (config.pattern == PatternT::Permutation)
+                {
+                    config.seed = std::stoul(getOption(args, "seed", "1"));
+                    permutation = getPermutation(config.p, config.seed);
+                }
+                config.permutation = permutation.data();
+                config.chains = std::stoul(getOption(args, "chains", "1"));
+                if (config.chains < 1 || config.chains > MAX_CHAINS || (config.chains > 1 && config.nextIndex == NextIndexT::CalculateNext))
+                {
+                    // The chain kernel only reads next.
+                    std::cout << "chains=" << config.chains << (config.chains > 1 && config.chains <= MAX_CHAINS ? " needs nextIndex r" : " is outside 1..32")
+                              << ": " << line << std::endl;
+                    continue;
+                }
+                config.blockLog = config.chains > 1 ? 0 : config.blockLog;
+                config.counters = std::stoul(getOption(args, "counters", "0")) != 0;
+                config.pages = pagesResolve(nameToPageModeT(getOption(args, "pages", "malloc")));
+                if (config.containerFamily != DataStructureT::Array && config.containerFamily != DataStructureT::Vector)
+                {
+                    config.pages = PAGES_MALLOC;
+                }
+                config.populate = std::stoul(getOption(args, "populate", "0")) != 0;
+                config.allocator = nameToAllocatorKindT(getOption(args, "allocator", "default"));
+                if (config.containerFamily != DataStructureT::Map && config.containerFamily != DataStructureT::Unordered_map)
+                {
+                    config.allocator = AllocatorKindT::Default;
+                }
+                config.insertOrder = nameToInsertOrderT(getOption(args, "insertOrder", "traversal"));
+                if (config.allocator == AllocatorKindT::Ordered && (config.containerFamily == DataStructureT::Map || config.insertOrder == InsertOrderT::Key))
+                {
+                    std::cout << "allocator=ordered needs u and insertOrder=traversal: " << line << std::endl;
+                    continue;
+                }
+                config.loadThreads = std::min(std::stoul(getOption(args, "loadThreads", "0")), 256ul);
+                config.loadKind = nameToLoadKindT(getOption(args, "loadKind", "read"));
+                config.loadBytesLog = std::clamp(std::stoul(getOption(args, "loadBytesLog", "26")), 15ul, 32ul);
+                config.loadPause = std::stoul(getOption(args, "loadPause", "0"));
+                config.snapshotDir = getOption(args, "snapshotDir", "");
+                config.latencyEvery = std::stoul(getOption(args, "latencyEvery", "0"));
+                config.prebuilt = false;
                 ResultT result = testDataStructure(config);
                 std::cout << config.toString() << "," << result.toString() << std::endl;
             }
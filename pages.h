@@ -0,0 +1,202 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <linux/mman.h>
+#include <pthread.h>
+#include <assert.h>
+
+// Page backing for the benchmark working sets, so that page-walk cost can be
+// told apart from cache-miss cost. malloc keeps the allocator's defaults; the
+// other modes mmap the buffer directly: 4k opts out of transparent huge
+// pages, thp aligns to 2M and asks for them with madvise, and 2m / 1g take
+// explicit MAP_HUGETLB pages. populate faults every page in at allocation so
+// that first-touch cost stays out of the timed region.
+typedef enum
+{
+    PAGES_MALLOC,
+    PAGES_4K,
+    PAGES_THP,
+    PAGES_2M,
+    PAGES_1G,
+    NUM_PAGE_MODES
+} PageModeT;
+
+static const char *const pageModeNames[NUM_PAGE_MODES] = {"malloc", "4k", "thp", "2m", "1g"};
+
+#define PAGE_BYTES_4K (1ull << 12)
+#define PAGE_BYTES_2M (1ull << 21)
+#define PAGE_BYTES_1G (1ull << 30)
+#define MIN_PAGE_ALLOCATIONS 64
+
+// mmap'd allocations live here so that pagesFree can take the place of free.
+// The table doubles when full rather than letting an allocation fall back to
+// malloc, since a row's pages column must describe every buffer it measured;
+// with the dataset cache, dozens of datasets can be resident at once. The
+// lock lets workers allocate and free alongside the main thread.
+typedef struct
+{
+    void *ptr;
+    size_t bytes;
+} PageAllocationT;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    PageAllocationT *allocations;
+    size_t capacity;
+} PageTableT;
+
+static inline PageTableT *pageTable(void)
+{
+    static PageTableT table = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+    return &table;
+}
+
+static inline void pagesRecord(void *ptr, const size_t bytes)
+{
+    PageTableT *table = pageTable();
+    pthread_mutex_lock(&table->lock);
+    size_t slot = 0;
+    while (slot < table->capacity && table->allocations[slot].ptr)
+    {
+        slot++;
+    }
+    if (slot == table->capacity)
+    {
+        const size_t capacity = table->capacity ? table->capacity * 2 : MIN_PAGE_ALLOCATIONS;
+        PageAllocationT *grown = (PageAllocationT *)realloc(table->allocations, sizeof(PageAllocationT) * capacity);
+        assert(grown); // Could not grow the page allocation table
+        memset(grown + table->capacity, 0, sizeof(PageAllocationT) * (capacity - table->capacity));
+        table->allocations = grown;
+        table->capacity = capacity;
+    }
+    table->allocations[slot].ptr = ptr;
+    table->allocations[slot].bytes = bytes;
+    pthread_mutex_unlock(&table->lock);
+}
+
+// Removes ptr from the table and returns its mapped length, or 0 if it was
+// not mapped here.
+static inline size_t pagesForget(void *ptr)
+{
+    PageTableT *table = pageTable();
+    size_t bytes = 0;
+    pthread_mutex_lock(&table->lock);
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (table->allocations[i].ptr == ptr)
+        {
+            bytes = table->allocations[i].bytes;
+            table->allocations[i].ptr = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+    return bytes;
+}
+
+static inline uint64_t pagesGetPageBytes(const PageModeT mode)
+{
+    return mode == PAGES_1G ? PAGE_BYTES_1G : (mode == PAGES_2M || mode == PAGES_THP ? PAGE_BYTES_2M : PAGE_BYTES_4K);
+}
+
+static inline void *pagesMap(const size_t bytes, const PageModeT mode, const int populate)
+{
+    const int hugeFlags = mode == PAGES_1G ? MAP_HUGETLB | MAP_HUGE_1GB : (mode == PAGES_2M ? MAP_HUGETLB | MAP_HUGE_2MB : 0);
+    // 4k and thp set their madvise before the pages are faulted in, so they
+    // populate by touching instead.
+    const int populateFlags = populate && hugeFlags ? MAP_POPULATE : 0;
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | hugeFlags | populateFlags, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Returns mode if a page of it can be mapped, otherwise the mode used instead.
+static inline PageModeT pagesResolve(const PageModeT mode)
+{
+    if (mode != PAGES_2M && mode != PAGES_1G)
+    {
+        return mode;
+    }
+    void *probe = pagesMap(pagesGetPageBytes(mode), mode, 0);
+    if (probe)
+    {
+        munmap(probe, pagesGetPageBytes(mode));
+        return mode;
+    }
+    fprintf(stderr, "pages=%s: no hugetlb pages reserved, using thp\n", pageModeNames[mode]);
+    return PAGES_THP;
+}
+
+static inline void *pagesAlloc(const size_t bytes, PageModeT mode, const int populate)
+{
+    if (mode == PAGES_MALLOC)
+    {
+        void *ptr = malloc(bytes);
+        if (populate && ptr)
+        {
+            memset(ptr, 0, bytes);
+        }
+        return ptr;
+    }
+    uint64_t pageBytes = pagesGetPageBytes(mode);
+    size_t mappedBytes = (bytes + pageBytes - 1ull) & ~(pageBytes - 1ull);
+    char *ptr = (char *)pagesMap(mappedBytes, mode, populate);
+    if (!ptr && (mode == PAGES_2M || mode == PAGES_1G))
+    {
+        // The reservation ran out part way through the run.
+        fprintf(stderr, "pages=%s: could not map %zu bytes, using thp\n", pageModeNames[mode], bytes);
+        mode = PAGES_THP;
+        pageBytes = PAGE_BYTES_2M;
+        mappedBytes = (bytes + pageBytes - 1ull) & ~(pageBytes - 1ull);
+    }
+    if (mode == PAGES_THP)
+    {
+        // Over-map by a huge page and trim, so that the buffer starts on a
+        // 2M boundary and every 2M of it can be backed by one huge page.
+        char *raw = (char *)pagesMap(mappedBytes + PAGE_BYTES_2M, mode, 0);
+        if (!raw)
+        {
+            return NULL;
+        }
+        ptr = (char *)(((uintptr_t)raw + PAGE_BYTES_2M - 1ull) & ~(uintptr_t)(PAGE_BYTES_2M - 1ull));
+        if (ptr > raw)
+        {
+            munmap(raw, ptr - raw);
+        }
+        munmap(ptr + mappedBytes, raw + PAGE_BYTES_2M - ptr);
+        madvise(ptr, mappedBytes, MADV_HUGEPAGE);
+    }
+    else if (mode == PAGES_4K && ptr)
+    {
+        madvise(ptr, mappedBytes, MADV_NOHUGEPAGE);
+    }
+    if (!ptr)
+    {
+        return NULL;
+    }
+    for (size_t offset = 0; populate && (mode == PAGES_4K || mode == PAGES_THP) && offset < mappedBytes; offset += PAGE_BYTES_4K)
+    {
+        ptr[offset] = 0;
+    }
+    pagesRecord(ptr, mappedBytes);
+    return ptr;
+}
+
+static inline void pagesFree(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    const size_t bytes = pagesForget(ptr);
+    if (bytes)
+    {
+        munmap(ptr, bytes);
+        return;
+    }
+    free(ptr);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Hardware counters around a timed region, read through perf_event_open as a
+// single group so that every event covers the same interval. Events the
+// machine or kernel will not give us read as NAN rather than failing the run,
+// which is also what every event reads as when counters are switched off.
+// Each thread opens its own group and counts only itself; a multithreaded
+// region sums perfStop over its threads with perfAdd.
+typedef enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_PENDING_MISSES, // Outstanding L1D misses summed over cycles (Intel only)
+    NUM_PERF_EVENTS
+} PerfEventT;
+
+typedef struct
+{
+    double counts[NUM_PERF_EVENTS];
+} PerfSampleT;
+
+typedef struct
+{
+    int opened;
+    int leader;
+    int fds[NUM_PERF_EVENTS];
+    int slots[NUM_PERF_EVENTS]; // Position of each event in the group read, -1 if missing
+    int numSlots;
+} PerfCountersT;
+
+#define PERF_CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+// L1D_PEND_MISS.PENDING: event 0x48, umask 0x01.
+#define PERF_INTEL_L1D_PEND_MISS_PENDING 0x0148ull
+
+static inline int perfOpenEvent(const uint32_t type, const uint64_t config, const int groupFd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = groupFd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+static inline int perfIsIntel(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+    return ebx == 0x756e6547u && edx == 0x49656e69u && ecx == 0x6c65746eu; // "GenuineIntel"
+}
+
+// Opened on a thread's first use and kept until perfClose or the process
+// exits.
+static inline PerfCountersT *perfCounters(void)
+{
+    static __thread PerfCountersT counters;
+    if (counters.opened)
+    {
+        return &counters;
+    }
+    counters.opened = 1;
+    counters.numSlots = 0;
+    const uint32_t types[NUM_PERF_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                             PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_RAW};
+    const uint64_t configs[NUM_PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES,
+                                               PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D),
+                                               PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL),
+                                               PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB),
+                                               PERF_INTEL_L1D_PEND_MISS_PENDING};
+    counters.leader = -1;
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        counters.fds[i] = -1;
+        counters.slots[i] = -1;
+        if (i == PERF_PENDING_MISSES && !perfIsIntel())
+        {
+            continue;
+        }
+        counters.fds[i] = perfOpenEvent(types[i], configs[i], counters.leader);
+        if (counters.fds[i] >= 0)
+        {
+            counters.leader = counters.leader == -1 ? counters.fds[i] : counters.leader;
+            counters.slots[i] = counters.numSlots++;
+        }
+    }
+    return &counters;
+}
+
+static inline PerfSampleT perfNone(void)
+{
+    PerfSampleT sample;
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        sample.counts[i] = NAN;
+    }
+    return sample;
+}
+
+static inline void perfStart(const int enabled)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    const PerfCountersT *counters = perfCounters();
+    if (counters->leader >= 0)
+    {
+        ioctl(counters->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+// Returns the counts since perfStart, scaled up if the group was multiplexed.
+static inline PerfSampleT perfStop(const int enabled)
+{
+    PerfSampleT sample = perfNone();
+    if (!enabled)
+    {
+        return sample;
+    }
+    const PerfCountersT *counters = perfCounters();
+    if (counters->leader < 0)
+    {
+        return sample;
+    }
+    ioctl(counters->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // The group read is the event count, the enabled and running times, then
+    // one value per opened event; anything shorter reads as NAN.
+    uint64_t values[3 + NUM_PERF_EVENTS] = {0};
+    const ssize_t bytes = read(counters->leader, values, sizeof(values));
+    if (bytes != (ssize_t)(sizeof(uint64_t) * (3 + counters->numSlots)) || values[2] == 0ull)
+    {
+        return sample;
+    }
+    const uint64_t timeEnabled = values[1];
+    const uint64_t timeRunning = values[2];
+    const double scale = (double)timeEnabled / (double)timeRunning;
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        if (counters->slots[i] >= 0)
+        {
+            sample.counts[i] = (double)values[3 + counters->slots[i]] * scale;
+        }
+    }
+    return sample;
+}
+
+// Called by threads that counted before they exit, so that their groups'
+// descriptors are not leaked.
+static inline void perfClose(void)
+{
+    PerfCountersT *counters = perfCounters();
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        if (counters->fds[i] >= 0)
+        {
+            close(counters->fds[i]);
+        }
+    }
+    counters->opened = 0;
+}
+
+static inline PerfSampleT perfAdd(PerfSampleT sample, const PerfSampleT other)
+{
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        sample.counts[i] += other.counts[i];
+    }
+    return sample;
+}
+
+static inline PerfSampleT perfPerAccess(PerfSampleT sample, const double accesses)
+{
+    for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+        sample.counts[i] /= accesses;
+    }
+    return sample;
+}
+
+static inline const char *perfGetHeader(void)
+{
+    return "cyclesPerAccess,instructionsPerAccess,l1dMissesPerAccess,llcMissesPerAccess,dtlbMissesPerAccess,pendingMissesPerAccess";
+}
+
+static inline void perfToString(const PerfSampleT sample, char *buffer, const size_t size)
+{
+    snprintf(buffer, size, "%f,%f,%f,%f,%f,%f", sample.counts[PERF_CYCLES], sample.counts[PERF_INSTRUCTIONS],
+             sample.counts[PERF_L1D_MISSES], sample.counts[PERF_LLC_MISSES], sample.counts[PERF_DTLB_MISSES],
+             sample.counts[PERF_PENDING_MISSES]);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Counter-based generator: draw n of a stream is a pure function of (seed,
+// stream, n), so a dataset can be generated in any order or split across any
+// number of threads and still come out bit-identical. Each stream is a
+// SplitMix64 sequence.
+#define PRNG_GOLDEN_GAMMA 0x9e3779b97f4a7c15ull
+
+static inline uint64_t prngMix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t prngKey(const uint64_t seed, const uint64_t stream)
+{
+    return prngMix(seed ^ prngMix(stream + PRNG_GOLDEN_GAMMA));
+}
+
+static inline uint64_t prngAt(const uint64_t key, const uint64_t counter)
+{
+    return prngMix(key + (counter + 1ull) * PRNG_GOLDEN_GAMMA);
+}
+
+// Uniform in [0, n).
+static inline uint64_t prngBelow(const uint64_t draw, const uint64_t n)
+{
+    return (uint64_t)(((unsigned __int128)draw * n) >> 64);
+}
+
+// Uniform in (0, 1), so it is always safe to take the log of.
+static inline double prngToOpenUnit(const uint64_t draw)
+{
+    return ((double)(draw >> 11) + 0.5) * 0x1.0p-53;
+}
+
+// Runs fn over [0, length) split into one contiguous range per thread. The
+// caller's draws must depend only on the element index for the output to be
+// independent of the thread count.
+typedef void (*RangeFnT)(void *context, uint64_t begin, uint64_t end);
+
+typedef struct
+{
+    RangeFnT fn;
+    void *context;
+    uint64_t begin;
+    uint64_t end;
+} RangeTaskT;
+
+static void *runRangeTask(void *arg)
+{
+    RangeTaskT *task = (RangeTaskT *)arg;
+    task->fn(task->context, task->begin, task->end);
+    return NULL;
+}
+
+#define MAX_INIT_THREADS 256
+
+static inline uint32_t getDefaultInitThreads(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1u : (cpus > MAX_INIT_THREADS ? MAX_INIT_THREADS : (uint32_t)cpus);
+}
+
+static inline void parallelFor(const uint64_t length, uint32_t threads, RangeFnT fn, void *context)
+{
+    // Small datasets are not worth a thread.
+    threads = length < (1ull << 16) ? 1u : threads;
+    threads = threads > MAX_INIT_THREADS ? MAX_INIT_THREADS : (threads < 1u ? 1u : threads);
+    RangeTaskT tasks[MAX_INIT_THREADS];
+    pthread_t handles[MAX_INIT_THREADS];
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        tasks[i] = (RangeTaskT){fn, context, length * i / threads, length * (i + 1ull) / threads};
+    }
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        pthread_create(&handles[i], NULL, runRangeTask, &tasks[i]);
+    }
+    runRangeTask(&tasks[0]);
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        pthread_join(handles[i], NULL);
+    }
+}
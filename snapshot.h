@@ -0,0 +1,157 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dataset_cache.h"
+
+// Generated datasets saved to disk so that later runs can mmap them instead
+// of building them again. A snapshot is a page-sized header followed by up to
+// MAX_SNAPSHOT_SECTIONS arrays, each starting on a page so it can be used in
+// place. The header records the full dataset key; the file name only carries
+// a hash of it, so a mismatched or older-version file is rebuilt rather than
+// used. Files are written under a temporary name and renamed, so concurrent
+// jobs never map a partial snapshot.
+#define SNAPSHOT_MAGIC "HW10SNP"
+#define SNAPSHOT_VERSION 1u
+#define MAX_SNAPSHOT_SECTIONS 4
+#define SNAPSHOT_ALIGN 4096ull
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numSections;
+    DatasetKeyT key;
+    uint64_t sectionBytes[MAX_SNAPSHOT_SECTIONS];
+} SnapshotHeaderT;
+
+typedef struct
+{
+    void *mapping; // NULL if nothing was mapped
+    size_t mappingBytes;
+    void *sections[MAX_SNAPSHOT_SECTIONS];
+    uint64_t sectionBytes[MAX_SNAPSHOT_SECTIONS];
+} SnapshotT;
+
+static inline uint64_t snapshotAlign(const uint64_t bytes)
+{
+    return (bytes + SNAPSHOT_ALIGN - 1ull) & ~(SNAPSHOT_ALIGN - 1ull);
+}
+
+// dir/name-<key hash>.snap, malloc'd.
+static inline char *snapshotPath(const char *dir, const char *name, const DatasetKeyT *key)
+{
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a over the key bytes
+    const unsigned char *bytes = (const unsigned char *)key;
+    for (size_t i = 0; i < sizeof(DatasetKeyT); i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    const size_t length = strlen(dir) + strlen(name) + 32;
+    char *path = (char *)malloc(length);
+    snprintf(path, length, "%s/%s-%016" PRIx64 ".snap", dir, name, hash);
+    return path;
+}
+
+// Maps a snapshot privately, so a kernel may write to it without touching the
+// file, and faults it in up front with populate. Returns an empty SnapshotT if
+// the file is missing or does not hold key.
+static inline SnapshotT snapshotMap(const char *path, const DatasetKeyT *key, const int populate)
+{
+    SnapshotT snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return snapshot;
+    }
+    SnapshotHeaderT header;
+    struct stat status;
+    const int valid = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && fstat(fd, &status) == 0 &&
+                      memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                      header.version == SNAPSHOT_VERSION && header.numSections <= MAX_SNAPSHOT_SECTIONS &&
+                      memcmp(&header.key, key, sizeof(DatasetKeyT)) == 0;
+    size_t mappingBytes = SNAPSHOT_ALIGN;
+    for (uint32_t i = 0; valid && i < header.numSections; i++)
+    {
+        mappingBytes += snapshotAlign(header.sectionBytes[i]);
+    }
+    if (!valid || (size_t)status.st_size < mappingBytes)
+    {
+        close(fd);
+        return snapshot;
+    }
+    void *mapping = mmap(NULL, mappingBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return snapshot;
+    }
+    snapshot.mapping = mapping;
+    snapshot.mappingBytes = mappingBytes;
+    char *section = (char *)mapping + SNAPSHOT_ALIGN;
+    for (uint32_t i = 0; i < header.numSections; i++)
+    {
+        snapshot.sections[i] = section;
+        snapshot.sectionBytes[i] = header.sectionBytes[i];
+        section += snapshotAlign(header.sectionBytes[i]);
+    }
+    return snapshot;
+}
+
+static inline void snapshotUnmap(SnapshotT *snapshot)
+{
+    if (snapshot->mapping)
+    {
+        munmap(snapshot->mapping, snapshot->mappingBytes);
+        snapshot->mapping = NULL;
+    }
+}
+
+static inline int snapshotWritePadded(FILE *fp, const void *data, const uint64_t bytes)
+{
+    static const char zeros[SNAPSHOT_ALIGN] = {0};
+    const uint64_t padding = snapshotAlign(bytes) - bytes;
+    return fwrite(data, 1, bytes, fp) == bytes && fwrite(zeros, 1, padding, fp) == padding;
+}
+
+// Returns 0 if the snapshot could not be written; the run goes on without it.
+static inline int snapshotWrite(const char *path, const DatasetKeyT *key, const uint32_t numSections,
+                                const void *const *sections, const uint64_t *sectionBytes)
+{
+    SnapshotHeaderT header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.numSections = numSections;
+    header.key = *key;
+    for (uint32_t i = 0; i < numSections; i++)
+    {
+        header.sectionBytes[i] = sectionBytes[i];
+    }
+    const size_t length = strlen(path) + 32;
+    char *temporary = (char *)malloc(length);
+    snprintf(temporary, length, "%s.%ld.tmp", path, (long)getpid());
+    FILE *fp = fopen(temporary, "wb");
+    int written = fp != NULL;
+    written = written && snapshotWritePadded(fp, &header, sizeof(header));
+    for (uint32_t i = 0; written && i < numSections; i++)
+    {
+        written = snapshotWritePadded(fp, sections[i], sectionBytes[i]);
+    }
+    written = fp && fclose(fp) == 0 && written;
+    written = written && rename(temporary, path) == 0;
+    if (!written)
+    {
+        fprintf(stderr, "snapshot: could not write %s\n", path);
+        unlink(temporary);
+    }
+    free(temporary);
+    return written;
+}
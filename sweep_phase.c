@@ -4,84 +4,382 @@
 #include <stdarg.h>
 #include "fasttime.h"
 #include "common.h"
+#include "prng.h"
+#include "pages.h"
+#include "dataset_cache.h"
+#include "snapshot.h"
 #include <assert.h>
 #include <math.h>
 #include <float.h>
 
+#define MAX_CURSORS_LOG 5
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
 typedef struct
 {
     uint64_t expectedBlockLength;
     uint64_t bufferLengthLog;
     uint64_t trials;
+    TrialPolicyT policy;
     uint64_t prefetchDistanceInBytes;
+    uint64_t seed;
+    uint32_t initThreads;
+    int counters;
+    uint64_t cursorsLog;
+    int adaptive;
+    uint64_t latencyEvery; // Time every Nth block in sampled passes, 0 for none
+    PageModeT pages;
+    int populate;
+    char *snapshotDir; // Where the buffer is mapped from or saved to, if set
 } ConfigT;
 
 char *getConfigHeader()
 {
-    return createFormattedString("HW10,expBlockBytes,totalKB,trials,prefetchDistanceInBytes");
+    return createFormattedString("HW10,expBlockBytes,totalKB,trials,ciPercent,budgetMs,prefetchDistanceInBytes,seed,cursors,adaptive,pages,populate");
 }
 
 char *configToString(ConfigT config)
 {
-    return createFormattedString("HW10,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64, 8 * config.expectedBlockLength, 1ull << (config.bufferLengthLog - 7ull), config.trials, config.prefetchDistanceInBytes);
+    return createFormattedString("HW10,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,%f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d,%s,%d", 8 * config.expectedBlockLength, 1ull << (config.bufferLengthLog - 7ull), config.trials,
+                                 config.policy.ciPercent, config.policy.budgetMs, config.prefetchDistanceInBytes,
+                                 config.seed, 1ull << config.cursorsLog, config.adaptive, pageModeNames[config.pages], config.populate);
 }
 
-static inline uint64_t getGeometricSample(const double oneMinusP)
+// The geometric sample is 1 + log(u) / log(1 - p), so the division and the
+// second log are hoisted out as invLogOneMinusP.
+static inline uint64_t getGeometricSample(const uint64_t draw, const double invLogOneMinusP)
 {
-    const double uniformSample = ((double)rand()) / ((double)RAND_MAX);
-    return (uint64_t)MAX(1.0, 1.0 + (log10(uniformSample) / log10(oneMinusP)));
+    return (uint64_t)MAX(1.0, 1.0 + log(prngToOpenUnit(draw)) * invLogOneMinusP);
+}
+
+typedef struct
+{
+    uint64_t *data;
+    uint64_t key;
+    double invLogOneMinusP;
+} GeometricFillT;
+
+static void fillGeometricRange(void *context, uint64_t begin, uint64_t end)
+{
+    const GeometricFillT *fill = context;
+    for (uint64_t i = begin; i < end; i++)
+    {
+        fill->data[i] = getGeometricSample(prngAt(fill->key, i), fill->invLogOneMinusP);
+        assert(fill->data[i] > 0ull);
+    }
 }
 
 static inline uint64_t *init(const ConfigT config)
 {
     const uint64_t bufferLength = 1ull << config.bufferLengthLog;
-    uint64_t *data = malloc(sizeof(uint64_t) * bufferLength);
     const double oneMinusP = 1.0 - (1.0 / ((double)config.expectedBlockLength));
+    GeometricFillT fill = {pagesAlloc(sizeof(uint64_t) * bufferLength, config.pages, config.populate), prngKey(config.seed, 0ull), 1.0 / log(oneMinusP)};
+    parallelFor(bufferLength, config.initThreads, fillGeometricRange, &fill);
+    return fill.data;
+}
+
+typedef struct
+{
+    uint64_t *data;
+    SnapshotT snapshot; // Mapping data points into, if it came from a snapshot
+} SweepDataT;
 
-    for (uint64_t i = 0ull; i < bufferLength; i++)
+static void destroyData(void *dataset)
+{
+    SweepDataT *entry = dataset;
+    if (entry->snapshot.mapping)
+    {
+        snapshotUnmap(&entry->snapshot);
+    }
+    else
     {
-        data[i] = getGeometricSample(oneMinusP);
-        assert(data[i] > 0ull);
+        pagesFree(entry->data);
     }
-    return data;
+    free(entry);
 }
 
-static inline ResultT testPrefetchDistance(const ConfigT config)
+// With a snapshot directory, the buffer is mapped from its snapshot when one
+// exists and saved to one after it is built. File mappings cannot take the
+// other page modes, so those always build.
+static inline SweepDataT *loadData(const ConfigT config, const uint64_t bytes)
 {
-    const uint64_t bufferLength = 1ull << config.bufferLengthLog;
-    const uint64_t bufferMask = bufferLength - 1ull;
+    SweepDataT *entry = calloc(1, sizeof(SweepDataT));
+    const DatasetKeyT key = {{config.expectedBlockLength, config.bufferLengthLog, config.seed}};
+    char *path = config.snapshotDir ? snapshotPath(config.snapshotDir, "sweep", &key) : NULL;
+    if (path && config.pages == PAGES_MALLOC)
+    {
+        entry->snapshot = snapshotMap(path, &key, config.populate);
+        entry->data = entry->snapshot.sections[0];
+    }
+    if (!entry->snapshot.mapping)
+    {
+        entry->data = init(config);
+        if (path)
+        {
+            const void *sections[] = {entry->data};
+            snapshotWrite(path, &key, 1u, sections, &bytes);
+        }
+    }
+    free(path);
+    return entry;
+}
 
-    uint64_t *data = init(config);
-    double nsPerAccess = DBL_MAX;
+// The buffer is only read, so lines that share its shape share one copy.
+static inline const uint64_t *getData(const ConfigT config)
+{
+    const DatasetKeyT key = {{config.expectedBlockLength, config.bufferLengthLog, config.seed, config.pages, config.populate}};
+    const SweepDataT *entry = datasetCacheGet(&key);
+    if (!entry)
+    {
+        const uint64_t bytes = sizeof(uint64_t) << config.bufferLengthLog;
+        datasetCacheReserve(bytes);
+        SweepDataT *loaded = loadData(config, bytes);
+        datasetCachePut(&key, loaded, bytes, destroyData);
+        entry = loaded;
+    }
+    return entry->data;
+}
+
+// Splits the buffer into K regions and walks one block chain per region, all
+// K cursors advancing in lockstep so that up to K misses are in flight. Each
+// cursor wraps within its own region, so every trial still visits
+// bufferLength blocks. K = 1 is the original single-chain sweep.
+//
+// The sweep only ever moves forward, so each cursor prefetches the line
+// distance words ahead of itself in its region (none when distance is 0).
+// offsets carries the cursor positions across calls, which lets the adaptive
+// sweep run the same pass as a series of shorter epochs.
+static ALWAYS_INLINE uint64_t sweepCursors(const uint64_t *data, const uint64_t regionLength, const uint64_t K,
+                                           uint64_t *offsets, const uint64_t steps, const uint64_t distance)
+{
+    const uint64_t regionMask = regionLength - 1ull;
     uint64_t loopSum = 0ull;
+    for (uint64_t i = 0ull; i < steps; i++)
+    {
+#pragma GCC unroll 32
+        for (uint64_t k = 0ull; k < K; k++)
+        {
+            const uint64_t *region = data + k * regionLength;
+            if (distance)
+            {
+                __builtin_prefetch(region + ((offsets[k] + distance) & regionMask));
+            }
+            const uint64_t block = region[offsets[k]];
+            loopSum += block;
+            offsets[k] = (offsets[k] + block) & regionMask;
+        }
+    }
+    return loopSum;
+}
 
-    for (uint64_t trial = 0; trial < config.trials; trial++)
+static uint64_t sweepSteps(const uint64_t *data, const ConfigT config, uint64_t *offsets, const uint64_t steps,
+                           const uint64_t distance)
+{
+    const uint64_t regionLength = 1ull << (config.bufferLengthLog - config.cursorsLog);
+    switch (config.cursorsLog)
     {
+    case 0:
+        return sweepCursors(data, regionLength, 1ull, offsets, steps, distance);
+    case 1:
+        return sweepCursors(data, regionLength, 2ull, offsets, steps, distance);
+    case 2:
+        return sweepCursors(data, regionLength, 4ull, offsets, steps, distance);
+    case 3:
+        return sweepCursors(data, regionLength, 8ull, offsets, steps, distance);
+    case 4:
+        return sweepCursors(data, regionLength, 16ull, offsets, steps, distance);
+    case 5:
+        return sweepCursors(data, regionLength, 32ull, offsets, steps, distance);
+    default:
+        assert(0); // Unsupported cursor count
+        return 0ull;
+    }
+}
+
+static uint64_t sweep(const uint64_t *data, const ConfigT config)
+{
+    uint64_t offsets[1ull << MAX_CURSORS_LOG] = {0ull};
+    return sweepSteps(data, config, offsets, 1ull << (config.bufferLengthLog - config.cursorsLog),
+                      config.prefetchDistanceInBytes / sizeof(uint64_t));
+}
+
+// Adaptive distances are 0 and the powers of two from one cache line up to
+// the largest distance the args accept.
+#define NUM_ADAPTIVE_DISTANCES 10
+#define ADAPTIVE_EPOCH_LOG 14
 
+static inline uint64_t getAdaptiveDistance(const uint32_t index)
+{
+    return index == 0u ? 0ull : 64ull << (index - 1u);
+}
+
+static inline uint32_t getAdaptiveIndex(const uint64_t distanceInBytes)
+{
+    uint32_t index = 0u;
+    while (index + 1u < NUM_ADAPTIVE_DISTANCES && getAdaptiveDistance(index + 1u) <= distanceInBytes)
+    {
+        index++;
+    }
+    return index;
+}
+
+// Hill climber over the distance ladder. Every epoch alternates between the
+// current distance and its neighbour in the current direction; the neighbour
+// is adopted when its blocks were cheaper, otherwise the direction flips.
+typedef struct
+{
+    uint32_t current;
+    int32_t direction;
+    int probing;
+    double currentNs;
+} TunerT;
+
+static uint64_t sweepAdaptive(const uint64_t *data, const ConfigT config, TunerT *tuner)
+{
+    uint64_t offsets[1ull << MAX_CURSORS_LOG] = {0ull};
+    const uint64_t totalSteps = 1ull << (config.bufferLengthLog - config.cursorsLog);
+    const uint64_t epochSteps = MAX(1ull, (1ull << ADAPTIVE_EPOCH_LOG) >> config.cursorsLog);
+    uint64_t loopSum = 0ull;
+    for (uint64_t done = 0ull; done < totalSteps; done += epochSteps)
+    {
+        const uint64_t steps = MIN(epochSteps, totalSteps - done);
+        int64_t next = (int64_t)tuner->current + tuner->direction;
+        if (tuner->probing && (next < 0 || next >= NUM_ADAPTIVE_DISTANCES))
+        {
+            tuner->direction = -tuner->direction;
+            next = (int64_t)tuner->current + tuner->direction;
+        }
+        const uint32_t index = tuner->probing ? (uint32_t)next : tuner->current;
         const fasttime_t t1 = gettime();
+        loopSum += sweepSteps(data, config, offsets, steps, getAdaptiveDistance(index) / sizeof(uint64_t));
+        const fasttime_t t2 = gettime();
+        const double ns = tdiff(t1, t2) * 1e9 / (double)(steps << config.cursorsLog);
+        if (!tuner->probing)
+        {
+            tuner->currentNs = ns;
+        }
+        else if (ns < tuner->currentNs)
+        {
+            tuner->current = index;
+        }
+        else
+        {
+            tuner->direction = -tuner->direction;
+        }
+        tuner->probing = !tuner->probing;
+    }
+    return loopSum;
+}
 
-        loopSum = 0ull;
-        uint64_t index = 0ull;
-        for (uint64_t i = 0ull; i < bufferLength; i++)
+// The same walk as sweepCursors, at one distance, with every Nth block load
+// timed on its own. Not specialized per cursor count, since only the
+// sampled loads are of interest.
+static uint64_t sweepSampled(const uint64_t *data, const ConfigT config, const uint64_t distance, LatencyHistogramT *histogram)
+{
+    const uint64_t K = 1ull << config.cursorsLog;
+    const uint64_t regionLength = 1ull << (config.bufferLengthLog - config.cursorsLog);
+    const uint64_t regionMask = regionLength - 1ull;
+    uint64_t offsets[1ull << MAX_CURSORS_LOG] = {0ull};
+    uint64_t loopSum = 0ull;
+    uint64_t countdown = config.latencyEvery;
+    for (uint64_t i = 0ull; i < regionLength; i++)
+    {
+        for (uint64_t k = 0ull; k < K; k++)
         {
-            // --------------------------- //
-            // Put prefetch code here
-            // --------------------------- //
-            loopSum += data[index];
-            index = (index + data[index]) & bufferMask;
+            const uint64_t *region = data + k * regionLength;
+            if (distance)
+            {
+                __builtin_prefetch(region + ((offsets[k] + distance) & regionMask));
+            }
+            uint64_t block;
+            if (--countdown == 0ull)
+            {
+                countdown = config.latencyEvery;
+                const fasttime_t t1 = gettime();
+                block = region[offsets[k]];
+                const fasttime_t t2 = gettime();
+                latencyHistogramAdd(histogram, t1, t2);
+            }
+            else
+            {
+                block = region[offsets[k]];
+            }
+            loopSum += block;
+            offsets[k] = (offsets[k] + block) & regionMask;
         }
+    }
+    return loopSum;
+}
+
+// Every sampled pass has to produce the trials' loopSum, which also keeps
+// its loads from being optimized away.
+static inline LatencySummaryT testLatency(const uint64_t *data, const ConfigT config, const uint64_t loopSum, const double nsPerAccess)
+{
+    if (config.latencyEvery == 0ull)
+    {
+        return latencyNone();
+    }
+    const uint64_t bufferLength = 1ull << config.bufferLengthLog;
+    const uint64_t passes = latencyGetPasses(bufferLength, config.latencyEvery);
+    LatencyHistogramT histogram;
+    latencyHistogramReset(&histogram);
+    const fasttime_t t1 = gettime();
+    uint64_t mismatches = 0ull;
+    for (uint64_t pass = 0ull; pass < passes; pass++)
+    {
+        mismatches += sweepSampled(data, config, config.prefetchDistanceInBytes / sizeof(uint64_t), &histogram) != loopSum;
+    }
+    const fasttime_t t2 = gettime();
+    if (mismatches)
+    {
+        fprintf(stderr, "latencyEvery: %" PRIu64 " sampled passes did not match loopSum\n", mismatches);
+    }
+    return latencySummarize(&histogram, config.latencyEvery, tdiff(t1, t2) * 1e9 / (double)(passes * bufferLength), nsPerAccess);
+}
+
+// With adaptive set, the positional distance is only the starting point and
+// config->prefetchDistanceInBytes is replaced by the distance the tuner had
+// settled on at the end of the fastest trial.
+static inline ResultT testPrefetchDistance(ConfigT *config)
+{
+    const uint64_t bufferLength = 1ull << config->bufferLengthLog;
+
+    const uint64_t *data = getData(*config);
+    double nsPerAccess = DBL_MAX;
+    PerfSampleT perAccess = perfNone();
+    uint64_t loopSum = 0ull;
+    TunerT tuner = {getAdaptiveIndex(config->prefetchDistanceInBytes), 1, 0, 0.0};
+    uint64_t chosenDistance = config->prefetchDistanceInBytes;
+    TrialSamplesT samples = {{0.0}, 0u, 0.0};
+
+    while (!trialsDone(&samples, config->policy))
+    {
+        perfStart(config->counters);
+        const fasttime_t t1 = gettime();
+        loopSum = config->adaptive ? sweepAdaptive(data, *config, &tuner) : sweep(data, *config);
         const fasttime_t t2 = gettime();
-        nsPerAccess = MIN(((tdiff(t1, t2) * 1e9) / ((double)bufferLength)), nsPerAccess);
+        const PerfSampleT sample = perfStop(config->counters);
+        const double trialNsPerAccess = (tdiff(t1, t2) * 1e9) / ((double)bufferLength);
+        trialSamplesAdd(&samples, trialNsPerAccess, tdiff(t1, t2) * 1e3);
+        if (trialNsPerAccess < nsPerAccess)
+        {
+            nsPerAccess = trialNsPerAccess;
+            perAccess = perfPerAccess(sample, (double)bufferLength);
+            chosenDistance = config->adaptive ? getAdaptiveDistance(tuner.current) : chosenDistance;
+        }
     }
-    free(data);
-    return (ResultT){loopSum, nsPerAccess};
+    config->prefetchDistanceInBytes = chosenDistance;
+    return (ResultT){loopSum, nsPerAccess, (sizeof(uint64_t) * bufferLength) / 1024ull, perAccess, trialStatsCompute(&samples),
+                     testLatency(data, *config, loopSum, nsPerAccess)};
 }
 
 #define BOUND(x, min, max) ((x) <= (min) ? (min) : ((x) >= (max) ? (max) : (x)))
 
 int main(int argc, char *argv[])
 {
-    // ./sweep_phase expected_block_length bytes_log trials prefetch_distance_in_bytes
+    // ./sweep_phase expected_block_length bytes_log trials prefetch_distance_in_bytes [seed=N] [initThreads=N] [counters=0|1] [cursors=1|2|4|...|32] [adaptive=0|1]
+    //                [pages=malloc|4k|thp|2m|1g] [populate=0|1] [cacheMB=N] [snapshotDir=path] [ciPercent=X] [budgetMs=N]
+    //                [latencyEvery=N]
     if (argc == 2)
     {
         FILE *fp = fopen(argv[1], "r");
@@ -90,7 +388,7 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        char line[256];
+        char line[1024];
         while (fgets(line, sizeof(line), fp))
         {
             ConfigT config;
@@ -102,18 +400,34 @@ int main(int argc, char *argv[])
                 config.expectedBlockLength = BOUND(expected_block_length, 1, 1024) / 8;
                 config.bufferLengthLog = BOUND(buffer_length_log, 14, 28) - 3;
                 config.trials = BOUND(trials, 1, 100);
+                config.policy = getTrialPolicy(line, config.trials);
                 config.prefetchDistanceInBytes = BOUND(prefetch_distance, 0, 16384);
+                config.seed = getOptionVal(line, "seed", 1ull, 0ull, UINT64_MAX);
+                config.initThreads = getOptionVal(line, "initThreads", getDefaultInitThreads(), 1ull, MAX_INIT_THREADS);
+                config.counters = getOptionVal(line, "counters", 0ull, 0ull, 1ull);
+                config.cursorsLog = 63ull - __builtin_clzll(getOptionVal(line, "cursors", 1ull, 1ull, 1ull << MAX_CURSORS_LOG));
+                config.adaptive = getOptionVal(line, "adaptive", 0ull, 0ull, 1ull);
+                config.latencyEvery = getOptionVal(line, "latencyEvery", 0ull, 0ull, UINT64_MAX);
+                config.pages = pagesResolve(getOptionChoice(line, "pages", pageModeNames, NUM_PAGE_MODES, PAGES_MALLOC));
+                config.populate = getOptionVal(line, "populate", 0ull, 0ull, 1ull);
+                config.snapshotDir = getOptionString(line, "snapshotDir");
+                if (findOption(line, "cacheMB"))
+                {
+                    datasetCacheSetBudget(getOptionVal(line, "cacheMB", 0ull, 0ull, UINT64_MAX >> 20) << 20);
+                }
                 
-                const ResultT result = testPrefetchDistance(config);
+                const ResultT result = testPrefetchDistance(&config);
                 char *configString = configToString(config);
                 char *resultString = resultToString(result);
                 printf("%s,%s\n", configString, resultString);
                 free(configString);
                 free(resultString);
+                free(config.snapshotDir);
             }
         }
         
         fclose(fp);
+        datasetCacheClear();
         return 0;
     }
     char *configHeader = getConfigHeader();
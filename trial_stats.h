@@ -0,0 +1,141 @@
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Per-trial nsPerAccess samples and their summary. With a fixed policy the
+// loop runs exactly trials times, as before. With an adaptive policy
+// (ciPercent > 0) it runs at least trials times, and at least
+// MIN_ADAPTIVE_TRIALS, then stops once the 95% confidence interval of the
+// mean is within ciPercent of the mean, once budgetMs of trial time has been
+// spent, or at MAX_TRIALS, whichever comes first. nsPerAccess stays the
+// fastest trial; the statistics describe the whole distribution, and read as
+// NAN where one trial cannot define them.
+#define MIN_ADAPTIVE_TRIALS 3u
+#define MAX_TRIALS 1000u
+
+typedef struct
+{
+    uint32_t trials;   // Fixed count, or the minimum when adaptive
+    double ciPercent;  // Target 95% CI half-width as a percentage of the mean, 0 for fixed
+    double budgetMs;   // Adaptive only: trial time after which to stop regardless
+} TrialPolicyT;
+
+typedef struct
+{
+    uint32_t trialsRun;
+    double median;
+    double mean;
+    double stddev;
+    double p90;
+    double p99;
+    double ci95; // Half-width of the 95% confidence interval of the mean
+} TrialStatsT;
+
+typedef struct
+{
+    double samples[MAX_TRIALS];
+    uint32_t count;
+    double elapsedMs;
+} TrialSamplesT;
+
+// Two-sided 95% Student t quantiles for 1..30 degrees of freedom.
+static inline double trialStudentT(const uint32_t degrees)
+{
+    static const double t[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    return degrees == 0u ? INFINITY : (degrees <= 30u ? t[degrees - 1u] : 1.960 + 2.5 / (double)degrees);
+}
+
+// Adds one trial's nsPerAccess, which took trialMs of wall time.
+static inline void trialSamplesAdd(TrialSamplesT *samples, const double nsPerAccess, const double trialMs)
+{
+    if (samples->count < MAX_TRIALS)
+    {
+        samples->samples[samples->count++] = nsPerAccess;
+    }
+    samples->elapsedMs += trialMs;
+}
+
+static int trialCompareDouble(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Linear interpolation between the closest ranks of sorted.
+static inline double trialPercentile(const double *sorted, const uint32_t count, const double percentile)
+{
+    const double rank = percentile / 100.0 * (double)(count - 1u);
+    const uint32_t below = (uint32_t)rank;
+    const uint32_t above = below + 1u < count ? below + 1u : below;
+    return sorted[below] + (rank - (double)below) * (sorted[above] - sorted[below]);
+}
+
+static inline TrialStatsT trialStatsCompute(const TrialSamplesT *samples)
+{
+    TrialStatsT stats;
+    memset(&stats, 0, sizeof(stats));
+    const uint32_t n = samples->count;
+    stats.trialsRun = n;
+    if (n == 0u)
+    {
+        return stats;
+    }
+    double sorted[MAX_TRIALS];
+    memcpy(sorted, samples->samples, sizeof(double) * n);
+    qsort(sorted, n, sizeof(double), trialCompareDouble);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        sum += sorted[i];
+    }
+    stats.mean = sum / (double)n;
+    double squares = 0.0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        squares += (sorted[i] - stats.mean) * (sorted[i] - stats.mean);
+    }
+    stats.stddev = n > 1u ? sqrt(squares / (double)(n - 1u)) : NAN;
+    stats.ci95 = n > 1u ? trialStudentT(n - 1u) * stats.stddev / sqrt((double)n) : NAN;
+    stats.median = trialPercentile(sorted, n, 50.0);
+    stats.p90 = trialPercentile(sorted, n, 90.0);
+    stats.p99 = trialPercentile(sorted, n, 99.0);
+    return stats;
+}
+
+// Whether the trial loop should stop before running another trial.
+static inline int trialsDone(const TrialSamplesT *samples, const TrialPolicyT policy)
+{
+    if (samples->count >= MAX_TRIALS || policy.ciPercent <= 0.0)
+    {
+        return samples->count >= MAX_TRIALS || samples->count >= policy.trials;
+    }
+    const uint32_t minTrials = policy.trials > MIN_ADAPTIVE_TRIALS ? policy.trials : MIN_ADAPTIVE_TRIALS;
+    if (samples->count > 0u && samples->elapsedMs >= policy.budgetMs)
+    {
+        return 1;
+    }
+    if (samples->count < minTrials)
+    {
+        return 0;
+    }
+    const TrialStatsT stats = trialStatsCompute(samples);
+    return stats.ci95 <= policy.ciPercent / 100.0 * stats.mean;
+}
+
+static inline const char *trialStatsGetHeader(void)
+{
+    return "trialsRun,medianNs,meanNs,stddevNs,p90Ns,p99Ns,ci95Ns";
+}
+
+static inline void trialStatsToString(const TrialStatsT stats, char *buffer, const size_t size)
+{
+    snprintf(buffer, size, "%" PRIu32 ",%f,%f,%f,%f,%f,%f", stats.trialsRun, stats.median, stats.mean, stats.stddev,
+             stats.p90, stats.p99, stats.ci95);
+}